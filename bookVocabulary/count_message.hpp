@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "word_table.hpp"
+
+/**
+ * Binary message with the counts of some rows of the bag-of-words matrix, used to send counts between
+ * MPI ranks. All the integers are unsigned LEB128 varints.
+ *
+ *   number of words, then every word as its length and its bytes (the string table)
+ *   number of rows, then for every row:
+ *       row of the matrix, number of pairs, then (word index in the string table, count) pairs
+ *
+ * Every word is sent once however many rows use it, only non-zero counts are sent, and words may
+ * hold any byte. The receiver reads the words straight from the message buffer.
+ **/
+
+/**
+ * Function that appends an unsigned integer to a message as a varint: 7 bits per byte, lowest first,
+ * with the high bit set on every byte but the last
+ *
+ * @param message bytes of the message
+ * @param value integer to append
+ *
+ **/
+inline void put_varint(std::vector<unsigned char> &message, std::uint64_t value) {
+    while (value >= 0x80) {
+        message.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    message.push_back((unsigned char)value);
+}
+
+/**
+ * Function that reads a varint of a message and moves past it
+ *
+ * @param p current position in the message
+ * @param end end of the message
+ * @param value where the integer is stored
+ *
+ * @return false if the message ends inside the varint or it does not fit in 64 bits
+ **/
+inline bool get_varint(const unsigned char *&p, const unsigned char *end, std::uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        const unsigned char byte = *p++;
+        value |= (std::uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Function that encodes the counts of some columns of some rows of the matrix into a message. The string
+ * table holds the chosen words in the given order, so a receiver interns them in that order.
+ *
+ * @param words table with the words of all the rows
+ * @param ids ids of the words to send, in the order of the string table
+ * @param rows row of the matrix of every count vector
+ * @param counts count vectors, indexed by the ids of the table
+ * @param message where the message is stored, replacing its contents
+ *
+ **/
+inline void encode_counts(const WordTable &words, const std::vector<int> &ids, const std::vector<int> &rows,
+                          const std::vector<std::vector<int>> &counts, std::vector<unsigned char> &message) {
+    message.clear();
+    put_varint(message, ids.size());
+    for (const int id : ids) {
+        std::string_view word = words.word(id);
+        put_varint(message, word.size());
+        message.insert(message.end(), word.begin(), word.end());
+    }
+
+    put_varint(message, rows.size());
+    for (std::size_t r = 0; r < rows.size(); r++) {
+        const std::vector<int> &count = counts[r];
+        std::size_t pairs = 0;
+        for (const int id : ids) {
+            pairs += id < (int)count.size() && count[id] > 0;
+        }
+        put_varint(message, rows[r]);
+        put_varint(message, pairs);
+        for (std::size_t index = 0; index < ids.size(); index++) {
+            const int id = ids[index];
+            if (id < (int)count.size() && count[id] > 0) {
+                put_varint(message, index);
+                put_varint(message, count[id]);
+            }
+        }
+    }
+}
+
+/**
+ * Function that decodes a message and adds its counts to the matrix. The words of the string table are
+ * interned into the table of the receiver straight from the message, and the pairs are translated to
+ * its ids, so rows received from several messages add up.
+ *
+ * @param message first byte of the message
+ * @param size bytes of the message
+ * @param words table of the receiver
+ * @param matrix counts of every row, indexed by the ids of the table; grown as needed
+ *
+ * @return false if the message is malformed
+ **/
+inline bool decode_counts(const unsigned char *message, const std::size_t size, WordTable &words, std::vector<std::vector<int>> &matrix) {
+    const unsigned char *p = message;
+    const unsigned char *end = message + size;
+    std::uint64_t num_words;
+    if (!get_varint(p, end, num_words) || num_words > size) {
+        return false;
+    }
+    std::vector<int> ids(num_words);
+    for (std::uint64_t w = 0; w < num_words; w++) {
+        std::uint64_t length;
+        if (!get_varint(p, end, length) || length > (std::uint64_t)(end - p)) {
+            return false;
+        }
+        ids[w] = words.intern(std::string_view(reinterpret_cast<const char *>(p), length));
+        p += length;
+    }
+
+    std::uint64_t num_rows;
+    if (!get_varint(p, end, num_rows)) {
+        return false;
+    }
+    for (std::uint64_t r = 0; r < num_rows; r++) {
+        std::uint64_t row, pairs;
+        if (!get_varint(p, end, row) || !get_varint(p, end, pairs) || row >= matrix.size()) {
+            return false;
+        }
+        std::vector<int> &count = matrix[row];
+        for (std::uint64_t k = 0; k < pairs; k++) {
+            std::uint64_t index, value;
+            if (!get_varint(p, end, index) || !get_varint(p, end, value) || index >= num_words) {
+                return false;
+            }
+            const int id = ids[index];
+            if (id >= (int)count.size()) {
+                count.resize(id + 1, 0);
+            }
+            count[id] += value;
+        }
+    }
+    return p == end;
+}
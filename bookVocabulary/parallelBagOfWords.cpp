@@ -1,20 +1,37 @@
 #include <mpi.h>
 #include <string>
 #include <iostream>
-#include <map>
-#include <set>
 #include <fstream>
 #include <vector>
-#include <sstream>
 #include <chrono>
 #include <numeric>
+#include <algorithm>
+#include <filesystem>
+#include "word_table.hpp"
+#include "count_message.hpp"
 
-void read_csv(const std::string &filename, std::map<std::string, int> &count, std::set<std::string> &vocabulary);
-void write_bag_of_words(const std::string& filename, const std::vector<std::map<std::string, int>> &counts, const std::set<std::string>& vocabulary);
-std::string serialize_set(const std::set<std::string> &s);
-void deserialize_set(const std::string &s, std::set<std::string> &set);
-std::string serialize_map(const std::map<std::string, int> &m);
-void deserialize_map(const std::string &s, std::map<std::string, int> &m);
+// Work items per rank aimed for when the books are split
+constexpr int CHUNKS_PER_RANK = 4;
+// Books are never split in ranges smaller than this
+constexpr std::size_t MIN_CHUNK_BYTES = 1 << 16;
+
+/**
+ * Piece of work: a byte range of one book
+ *
+ * book: row of the book in the output matrix
+ * first, last: byte range of the book, cut anywhere (see read_csv)
+ **/
+struct WorkItem {
+    int book;
+    std::size_t first;
+    std::size_t last;
+};
+
+std::vector<WorkItem> plan_work(const std::vector<std::string> &filenames, const int size);
+int next_item(MPI_Win counter);
+void exchange_slices(const WordTable &words, const std::vector<int> &rows, const std::vector<std::vector<int>> &counts,
+                     WordTable &slice_words, std::vector<std::vector<int>> &slice_counts, const int rank, const int size);
+void merge_tree(WordTable &words, std::vector<std::vector<int>> &counts, std::vector<int> &vocabulary, const int rank, const int size);
 
 int main(int argc, char* argv[]) {
     MPI_Init(&argc, &argv);
@@ -34,84 +51,55 @@ int main(int argc, char* argv[]) {
     int nBooks = argc - 1;
     auto start = std::chrono::high_resolution_clock::now();
 
-    std::map<std::string, int> local_count;
-    std::set<std::string> local_vocabulary;
-    std::set<std::string> global_vocabulary;
-
-    if (rank < nBooks) {
-        std::string filename = std::string("./books/") + argv[rank + 1] + ".txt";
-        read_csv(filename, local_count, local_vocabulary);
+    std::vector<std::string> filenames;
+    for (int i = 1; i <= nBooks; i++) {
+        filenames.push_back(std::string("./books/") + argv[i] + ".txt");
     }
+    const std::vector<WorkItem> items = plan_work(filenames, size);
 
-    std::string localVocabString = serialize_set(local_vocabulary);
-    int localVocabSize = localVocabString.size();
-    std::vector<int> allVocabSizes(size);
-    std::vector<char> allVocabStrings;
-    std::vector<int> displs(size);
-
-    MPI_Gather(&localVocabSize, 1, MPI_INT, allVocabSizes.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
-
+    // Shared counter of the next work item, kept on rank 0 and taken with an atomic fetch-and-add
+    int* next = nullptr;
+    MPI_Win counter;
+    MPI_Win_allocate(rank == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &next, &counter);
     if (rank == 0) {
-        int totalVocabSize = std::accumulate(allVocabSizes.begin(), allVocabSizes.end(), 0);
-        allVocabStrings.resize(totalVocabSize);
-        displs[0] = 0;
-        for (int i = 1; i < size; ++i) {
-            displs[i] = displs[i - 1] + allVocabSizes[i - 1];
-        }
+        *next = 0;
     }
-
-    MPI_Gatherv(localVocabString.data(), localVocabSize, MPI_CHAR, allVocabStrings.data(), allVocabSizes.data(), displs.data(), MPI_CHAR, 0, MPI_COMM_WORLD);
-
-    if (rank == 0) {
-        std::istringstream iss(std::string(allVocabStrings.begin(), allVocabStrings.end()));
-        std::string word;
-        while (iss >> word) {
-            global_vocabulary.insert(word);
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock_all(0, counter);
+
+    // Every rank takes items until none are left; ranges of the same book add up in its row
+    WordTable local_words;
+    std::vector<int> localRows;
+    std::vector<std::vector<int>> localCounts;
+    std::vector<int> bookRow(nBooks, -1);
+    for (int i = next_item(counter); i < (int)items.size(); i = next_item(counter)) {
+        const WorkItem &item = items[i];
+        if (bookRow[item.book] < 0) {
+            bookRow[item.book] = localRows.size();
+            localRows.push_back(item.book);
+            localCounts.emplace_back();
         }
+        read_csv(filenames[item.book], local_words, localCounts[bookRow[item.book]], item.first, item.last);
     }
 
-    std::string localCountString = serialize_map(local_count) + "|"; // Ensure each map ends with a delimiter
-    int localCountSize = localCountString.size();
-    std::vector<int> allCountSizes(size);
+    MPI_Win_unlock_all(counter);
+    MPI_Win_free(&counter);
 
-    MPI_Gather(&localCountSize, 1, MPI_INT, allCountSizes.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    // Every rank owns the words whose hash falls on it and merges their counts from all the ranks
+    WordTable slice_words;
+    std::vector<std::vector<int>> slice_counts(nBooks);
+    exchange_slices(local_words, localRows, localCounts, slice_words, slice_counts, rank, size);
 
-    std::vector<char> allCountStrings;
-    int totalCountSize = 0;
-    std::vector<int> countDispls(size);  // Declaration of countDispls
-
-    if (rank == 0) {
-        totalCountSize = std::accumulate(allCountSizes.begin(), allCountSizes.end(), 0);
-        allCountStrings.resize(totalCountSize);
-        countDispls[0] = 0;
-        for (int i = 1; i < size; ++i) {
-            countDispls[i] = countDispls[i - 1] + allCountSizes[i - 1];
-        }
-    }
-
-    MPI_Gatherv(localCountString.data(), localCountSize, MPI_CHAR, allCountStrings.data(), allCountSizes.data(), countDispls.data(), MPI_CHAR, 0, MPI_COMM_WORLD);
-
-    std::vector<std::map<std::string, int>> all_counts(size);
-    if (rank == 0) {
-        std::istringstream iss(std::string(allCountStrings.begin(), allCountStrings.end()));
-        std::string serializedMap;
-        for (int i = 0; i < size; ++i) {
-            if (!std::getline(iss, serializedMap, '|')) {
-                std::cerr << "Error: Failed to extract serialized map for process " << i << std::endl;
-                continue;
-            }
-            if (!serializedMap.empty()) {
-                deserialize_map(serializedMap, all_counts[i]);
-            }
-        }
-    }
+    // The sorted slices are merged up a binomial tree, so rank 0 ends with the matrix in column order
+    std::vector<int> vocabulary = slice_words.sorted_ids();
+    merge_tree(slice_words, slice_counts, vocabulary, rank, size);
 
     if (rank == 0) {
         auto end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> duration = end - start;
         std::cout << "Tiempo total de procesamiento (sin escritura): " << duration.count() << " segundos" << std::endl;
         std::string out_file = "bag_of_words_parallel.csv";
-        write_bag_of_words(out_file, all_counts, global_vocabulary);
+        write_bag_of_words(out_file, slice_words, slice_counts, vocabulary);
     }
 
     MPI_Finalize();
@@ -119,115 +107,149 @@ int main(int argc, char* argv[]) {
 }
 
 /**
- * Function that reads a book in csv format and stores all its words in a set and their count on a map
+ * Function that splits the books into work items. Books larger than the target size are cut into equal
+ * byte ranges, aiming at CHUNKS_PER_RANK items per rank and never below MIN_CHUNK_BYTES, and the items
+ * are sorted from the largest to the smallest so the last ones taken are the short ones. Every rank
+ * computes the same plan from the sizes of the files.
  *
- * @param filename name of the file to be read
- * @param count map where the count for each word will be stored
- * @param vocabulary set with the words present in all books
+ * @param filenames name of the file of every book
+ * @param size number of ranks
  *
+ * @return work items in the order they are handed out
  **/
-void read_csv(const std::string &filename, std::map<std::string, int> &count, std::set<std::string> &vocabulary) {
-    std::ifstream file(filename);
-    std::string word;
-
-    while (std::getline(file, word, ',')) {
-        if (count.find(word) == count.end()) {
-            count[word] = 0;
+std::vector<WorkItem> plan_work(const std::vector<std::string> &filenames, const int size) {
+    std::vector<std::size_t> bytes(filenames.size(), 0);
+    for (std::size_t b = 0; b < filenames.size(); b++) {
+        std::error_code error;
+        bytes[b] = std::filesystem::file_size(filenames[b], error);
+        if (error) {
+            bytes[b] = 0;
         }
-        count[word]++;
-        vocabulary.insert(word);
     }
-}
-
-/**
- * Function that writes the counts of words present in each book given the complete vocabulary in a csv format
- *
- * @param filename name of the file where the result will be stored
- * @param counts vector of maps that contains the counts of words for each book given
- * @param vocabulary set with the words present in all books
- *
- **/
-void write_bag_of_words(const std::string& filename, const std::vector<std::map<std::string, int>> &counts, const std::set<std::string>& vocabulary) {
-    std::ofstream file(filename);
-
-    for (const std::string& elem : vocabulary) {
-        file << elem << ",";
-    }
-    file << "\n";
-
-    for (const auto &count_map : counts) {
-        for (const std::string &elem : vocabulary) {
-            if (count_map.find(elem) != count_map.end()) {
-                file << count_map.at(elem) << ",";
-            } else {
-                file << "0" << ",";
-            }
+    const std::size_t total = std::accumulate(bytes.begin(), bytes.end(), (std::size_t)0);
+    const std::size_t target = std::max(total / ((std::size_t)size * CHUNKS_PER_RANK), MIN_CHUNK_BYTES);
+
+    std::vector<WorkItem> items;
+    for (std::size_t b = 0; b < filenames.size(); b++) {
+        const std::size_t chunks = std::max<std::size_t>((bytes[b] + target - 1) / target, 1);
+        for (std::size_t c = 0; c < chunks; c++) {
+            items.push_back({(int)b, bytes[b] * c / chunks, c + 1 == chunks ? std::string::npos : bytes[b] * (c + 1) / chunks});
         }
-        file << "\n";
     }
+    std::stable_sort(items.begin(), items.end(), [&bytes](const WorkItem &a, const WorkItem &b) {
+        const std::size_t size_a = std::min(a.last, bytes[a.book]) - a.first;
+        const std::size_t size_b = std::min(b.last, bytes[b.book]) - b.first;
+        return size_a > size_b;
+    });
+    return items;
 }
 
 /**
- * Function that turns a sets of strings into a single string where all the words are divided by white spaces.
- * Then, this string can be sent through MPI in a single communication operation.
+ * Function that takes the next work item from the counter on rank 0
  *
- * @param s set of strings
+ * @param counter window with the counter, locked with MPI_Win_lock_all
  *
- * @return string containing all the words in the set
+ * @return index of the item; past the last item when there is no work left
  **/
-std::string serialize_set(const std::set<std::string> &s) {
-    std::ostringstream oss;
-    for (const auto &word : s) {
-        oss << word << " ";
-    }
-    return oss.str();
+int next_item(MPI_Win counter) {
+    const int one = 1;
+    int item;
+    MPI_Fetch_and_op(&one, &item, MPI_INT, 0, 0, MPI_SUM, counter);
+    MPI_Win_flush(0, counter);
+    return item;
 }
 
 /**
- * Function that turns a string of words separated by white spaces into a set in order to have the
- * original set rebuilt for further processing.
+ * Function that hands every word to the rank that owns it, chosen by its hash, with one MPI_Alltoallv.
+ * Every rank sends each owner the counts of its words for the books it worked on and adds up what it
+ * receives, so the merge is split evenly among the ranks instead of done by rank 0 alone.
  *
- * @param s serialized set as a string
- * @param set set where the words will be stored
+ * @param words table with the words counted by this rank
+ * @param rows book of every count vector
+ * @param counts count vectors of this rank, indexed by the ids of the table
+ * @param slice_words table where the words owned by this rank are stored
+ * @param slice_counts counts of the owned words for every book, indexed by the ids of slice_words
+ * @param rank rank of the process
+ * @param size number of ranks
  *
  **/
-void deserialize_set(const std::string &s, std::set<std::string> &set) {
-    std::istringstream iss(s);
-    std::string word;
-    while (iss >> word) {
-        set.insert(word);
+void exchange_slices(const WordTable &words, const std::vector<int> &rows, const std::vector<std::vector<int>> &counts,
+                     WordTable &slice_words, std::vector<std::vector<int>> &slice_counts, const int rank, const int size) {
+    std::vector<std::vector<int>> owned(size);
+    for (int id = 0; id < words.size(); id++) {
+        owned[words.hash(id) % size].push_back(id);
     }
-}
 
-/**
- * Function that turns a map of string keys and integer values where each key-value is separated by white spaces
- * Then, this string can be sent through MPI in a single communication operation.
- * 
- * @param s map with strings as keys and ints as values
- *
- * @return string containing words and their respective counts
- **/
-std::string serialize_map(const std::map<std::string, int> &m) {
-    std::ostringstream oss;
-    for (const auto &pair : m) {
-        oss << pair.first << " " << pair.second << " ";
+    std::vector<unsigned char> sendBuffer;
+    std::vector<unsigned char> message;
+    std::vector<int> sendSizes(size), sendDispls(size);
+    for (int dest = 0; dest < size; dest++) {
+        encode_counts(words, owned[dest], rows, counts, message);
+        sendDispls[dest] = sendBuffer.size();
+        sendSizes[dest] = message.size();
+        sendBuffer.insert(sendBuffer.end(), message.begin(), message.end());
+    }
+
+    std::vector<int> recvSizes(size), recvDispls(size);
+    MPI_Alltoall(sendSizes.data(), 1, MPI_INT, recvSizes.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    recvDispls[0] = 0;
+    for (int i = 1; i < size; ++i) {
+        recvDispls[i] = recvDispls[i - 1] + recvSizes[i - 1];
+    }
+    std::vector<unsigned char> recvBuffer(recvDispls[size - 1] + recvSizes[size - 1]);
+    MPI_Alltoallv(sendBuffer.data(), sendSizes.data(), sendDispls.data(), MPI_BYTE,
+                  recvBuffer.data(), recvSizes.data(), recvDispls.data(), MPI_BYTE, MPI_COMM_WORLD);
+
+    for (int i = 0; i < size; ++i) {
+        if (!decode_counts(recvBuffer.data() + recvDispls[i], recvSizes[i], slice_words, slice_counts)) {
+            std::cerr << "Error: Process " << rank << " failed to decode the counts of process " << i << std::endl;
+        }
     }
-    return oss.str();
 }
 
 /**
- * Function that turns a string of words and counts separated by white spaces into a map in order to have the
- * original map rebuilt for further processing.
+ * Function that merges the sorted slices of all the ranks into rank 0 along a binomial tree. At every
+ * level half of the remaining ranks send their slice, with the string table in order, to a partner that
+ * merges the two sorted vocabularies in linear time; after log2(size) levels rank 0 holds every word in
+ * order and only the final matrix has been gathered.
  *
- * @param s serialized map as a string
- * @param set map where the words will be stored
+ * @param words table with the words owned by this rank; receives the words of its partners
+ * @param counts counts of the words for every book, indexed by the ids of the table
+ * @param vocabulary ids of the table in increasing order of the words; kept sorted as slices arrive
+ * @param rank rank of the process
+ * @param size number of ranks
  *
  **/
-void deserialize_map(const std::string &s, std::map<std::string, int> &m) {
-    std::istringstream iss(s);
-    std::string key;
-    int value;
-    while (iss >> key >> value) {
-        m[key] = value;
+void merge_tree(WordTable &words, std::vector<std::vector<int>> &counts, std::vector<int> &vocabulary, const int rank, const int size) {
+    std::vector<int> books(counts.size());
+    std::iota(books.begin(), books.end(), 0);
+    std::vector<unsigned char> message;
+
+    for (int step = 1; step < size; step <<= 1) {
+        if (rank & step) {
+            encode_counts(words, vocabulary, books, counts, message);
+            MPI_Send(message.data(), message.size(), MPI_BYTE, rank - step, 0, MPI_COMM_WORLD);
+            return;
+        }
+        if (rank + step < size) {
+            MPI_Status status;
+            int messageSize;
+            MPI_Probe(rank + step, 0, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_BYTE, &messageSize);
+            message.resize(messageSize);
+            MPI_Recv(message.data(), messageSize, MPI_BYTE, rank + step, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+            // Words new to the table get the next ids in the order of the sender, which is sorted
+            const int known = words.size();
+            if (!decode_counts(message.data(), messageSize, words, counts)) {
+                std::cerr << "Error: Process " << rank << " failed to decode the slice of process " << rank + step << std::endl;
+            }
+            std::vector<int> received(words.size() - known);
+            std::iota(received.begin(), received.end(), known);
+            std::vector<int> merged(vocabulary.size() + received.size());
+            std::merge(vocabulary.begin(), vocabulary.end(), received.begin(), received.end(), merged.begin(),
+                       [&words](const int a, const int b) { return words.word(a) < words.word(b); });
+            vocabulary.swap(merged);
+        }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Bytes read at a time past the end of a range until the word that crosses it ends
+constexpr std::size_t READ_EXTEND_BYTES = 1 << 12;
+
+/**
+ * Table of interned words. Every distinct word is copied once into an arena and gets a dense id,
+ * in order of first appearance, so the counts of a book are a plain vector indexed by id. Lookups
+ * use an open-addressing hash table (linear probing, at most half full) whose slots hold ids; the
+ * hash of every word is kept so the table can grow without hashing the words again, and so most
+ * probes are rejected without comparing strings.
+ **/
+class WordTable {
+public:
+    WordTable() : slots_(MIN_SLOTS, -1) {}
+
+    /**
+     * Function that returns the id of a word, adding it to the table if it is new. A word already
+     * in the table costs one probe sequence and no allocation.
+     *
+     * @param word word to look up
+     *
+     * @return id of the word
+     **/
+    int intern(std::string_view word) {
+        const std::uint64_t hash = hash_word(word);
+        const std::size_t mask = slots_.size() - 1;
+        std::size_t slot = hash & mask;
+        while (slots_[slot] >= 0) {
+            const int id = slots_[slot];
+            if (hashes_[id] == hash && this->word(id) == word) {
+                return id;
+            }
+            slot = (slot + 1) & mask;
+        }
+
+        const int id = hashes_.size();
+        slots_[slot] = id;
+        hashes_.push_back(hash);
+        offsets_.push_back(arena_.size());
+        arena_.append(word.data(), word.size());
+        if (2 * hashes_.size() > slots_.size()) {
+            grow();
+        }
+        return id;
+    }
+
+    /**
+     * Function that returns the word with a given id; the view is valid until the next word is added
+     *
+     * @param id id returned by intern()
+     *
+     * @return word with that id
+     **/
+    std::string_view word(const int id) const {
+        const std::size_t begin = offsets_[id];
+        const std::size_t end = id + 1 < (int)offsets_.size() ? offsets_[id + 1] : arena_.size();
+        return std::string_view(arena_.data() + begin, end - begin);
+    }
+
+    /**
+     * Function that returns the number of distinct words in the table
+     **/
+    int size() const {
+        return hashes_.size();
+    }
+
+    /**
+     * Function that returns the hash of the word with a given id, the same on every process
+     *
+     * @param id id returned by intern()
+     *
+     * @return hash of the word
+     **/
+    std::uint64_t hash(const int id) const {
+        return hashes_[id];
+    }
+
+    /**
+     * Function that sorts the ids by their word, which gives the vocabulary in the same order as a std::set
+     *
+     * @return ids of all the words in increasing order of the words
+     **/
+    std::vector<int> sorted_ids() const {
+        std::vector<int> ids(size());
+        std::iota(ids.begin(), ids.end(), 0);
+        std::sort(ids.begin(), ids.end(), [this](const int a, const int b) { return word(a) < word(b); });
+        return ids;
+    }
+
+private:
+    static constexpr std::size_t MIN_SLOTS = 1 << 10;
+
+    /**
+     * FNV-1a hash of a word
+     **/
+    static std::uint64_t hash_word(std::string_view word) {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (const char c : word) {
+            hash ^= (unsigned char)c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    /**
+     * Doubles the slots and places every id again from its stored hash
+     **/
+    void grow() {
+        std::vector<int> slots(2 * slots_.size(), -1);
+        const std::size_t mask = slots.size() - 1;
+        for (int id = 0; id < size(); id++) {
+            std::size_t slot = hashes_[id] & mask;
+            while (slots[slot] >= 0) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = id;
+        }
+        slots_.swap(slots);
+    }
+
+    std::string arena_;
+    std::vector<std::size_t> offsets_;
+    std::vector<std::uint64_t> hashes_;
+    std::vector<int> slots_;
+};
+
+/**
+ * Function that reads a book in csv format, or a byte range of it, and counts its words. The bytes are
+ * read at once and split on ',' in place, like std::getline with ',' as delimiter would (an empty word
+ * after the last ',' is not counted), so no string is built per word. A range counts the words that
+ * start inside it, including the end of the last one, so consecutive ranges count every word once
+ * wherever they are cut.
+ *
+ * @param filename name of the file to be read
+ * @param words table where the words of all the books are interned
+ * @param count count of each word of the book, indexed by its id; grown as new words appear
+ * @param first first byte of the range
+ * @param last one past the last byte of the range, the whole file by default
+ *
+ **/
+inline void read_csv(const std::string &filename, WordTable &words, std::vector<int> &count,
+                     const std::size_t first = 0, std::size_t last = std::string::npos) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "Error: could not open " << filename << std::endl;
+        return;
+    }
+    const std::size_t size = file.tellg();
+    last = std::min(last, size);
+    if (first >= last) {
+        return;
+    }
+
+    // The byte before the range tells whether a word starts at its first byte, and the last word
+    // that starts in the range is read up to the next ','
+    const std::size_t from = first > 0 ? first - 1 : 0;
+    std::string text(last - from, '\0');
+    file.seekg(from);
+    file.read(&text[0], text.size());
+    std::size_t tail = text.find(',', last - 1 - from);
+    while (tail == std::string::npos && from + text.size() < size) {
+        const std::size_t read = text.size();
+        text.resize(std::min(read + READ_EXTEND_BYTES, size - from));
+        file.read(&text[read], text.size() - read);
+        tail = text.find(',', read);
+    }
+
+    const char* begin = text.data();
+    const char* end = tail == std::string::npos ? text.data() + text.size() : text.data() + tail + 1;
+    if (first > 0) {
+        const char* comma = static_cast<const char*>(std::memchr(begin, ',', end - begin));
+        if (!comma || comma + 1 >= text.data() + (last - from)) {
+            return;
+        }
+        begin = comma + 1;
+    }
+    while (begin < end) {
+        const char* comma = static_cast<const char*>(std::memchr(begin, ',', end - begin));
+        const char* stop = comma ? comma : end;
+        const int id = words.intern(std::string_view(begin, stop - begin));
+        if (id >= (int)count.size()) {
+            count.resize(id + 1, 0);
+        }
+        count[id]++;
+        begin = stop + 1;
+    }
+}
+
+/**
+ * Function that writes the counts of words present in each book given the complete vocabulary in a csv format
+ *
+ * @param filename name of the file where the result will be stored
+ * @param words table with the words of all the books
+ * @param counts count of each word of every book, indexed by id; missing ids count 0
+ * @param vocabulary ids of the words in the order of the columns
+ *
+ **/
+inline void write_bag_of_words(const std::string& filename, const WordTable &words, const std::vector<std::vector<int>> &counts,
+                               const std::vector<int> &vocabulary) {
+    std::ofstream file(filename);
+
+    for (const int id : vocabulary) {
+        file << words.word(id) << ",";
+    }
+    file << "\n";
+
+    for (const std::vector<int> &count : counts) {
+        for (const int id : vocabulary) {
+            file << (id < (int)count.size() ? count[id] : 0) << ",";
+        }
+        file << "\n";
+    }
+}
+
+/**
+ * Function that writes the counts of words present in each book with the words in increasing order
+ *
+ * @param filename name of the file where the result will be stored
+ * @param words table with the words of all the books
+ * @param counts count of each word of every book, indexed by id; missing ids count 0
+ *
+ **/
+inline void write_bag_of_words(const std::string& filename, const WordTable &words, const std::vector<std::vector<int>> &counts) {
+    write_bag_of_words(filename, words, counts, words.sorted_ids());
+}
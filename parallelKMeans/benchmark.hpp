@@ -0,0 +1,842 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "point_set.hpp"
+#include "convergence.hpp"
+#include "telemetry.hpp"
+#include "synthetic_data.hpp"
+#include "numa.hpp"
+#include "result_writer.hpp"
+#include "point_order.hpp"
+
+// Format of the benchmark records
+enum class BenchmarkFormat {
+    TEXT,   // one readable line per record
+    CSV,    // header and one row per record
+    JSON    // array with one object per record
+};
+
+/**
+ * Settings of a benchmark run, filled by parse_benchmark_args()
+ *
+ * inputs: csv files to cluster; a .bin with the same name is mapped instead when it exists
+ * synthetic: data sets to generate instead of (or besides) reading files
+ * clusters: number of centroids used by k-means
+ * seed: seed of the generated data and of the centroid seeding
+ * threads: thread counts to sweep
+ * warmup: untimed runs before the timed ones, for every thread count
+ * repetitions: timed runs for every thread count
+ * pin: bind every OpenMP thread to its own cpu when the runtime does not bind them already
+ * write_results: write the assignments of every data set to <name>_results.csv
+ * binary_results: write only the assignments, as int32, to <name>_assignments.bin instead
+ * float32: cluster in single precision (only the parallel program)
+ * engine: assignment engine name (only the parallel program)
+ * check_kd_tree: compare a sample of the k-d tree labels with brute force every iteration (only the parallel program)
+ * n_init: restarts of every clustering, keeping the lowest inertia (only the parallel program)
+ * sweep: largest k of a warm-started k sweep from clusters, 0 for no sweep (only the parallel program)
+ * batch_size: points per batch of the streaming mini-batch k-means, 0 to load the whole data set (only the parallel program)
+ * epochs: passes over the file of the mini-batch k-means
+ * order: order the points are stored in for the clustering (see point_order.hpp); results keep the original order
+ * places: OMP_PLACES the program restarts itself with, empty to keep the environment (only the parallel program)
+ * bind: OMP_PROC_BIND used together with places
+ * replicate_centroids: keep a copy of the centroids on every NUMA node (only the parallel program)
+ * telemetry: file for the per-iteration records of the last timed run, empty to skip them (only the parallel program)
+ * hardware_counters: add cycles and last-level cache misses of every phase to the telemetry
+ * format: format of the records
+ * output: file for the records, empty for the standard output
+ **/
+struct BenchmarkOptions {
+    std::vector<std::string> inputs;
+    std::vector<SyntheticOptions> synthetic;
+    int clusters = 5;
+    std::uint64_t seed = 0;
+    std::vector<int> threads;
+    int warmup = 1;
+    int repetitions = 10;
+    bool pin = true;
+    bool write_results = true;
+    bool binary_results = false;
+    bool float32 = false;
+    std::string engine = "brute_force";
+    bool check_kd_tree = false;
+    int n_init = 1;
+    int sweep = 0;
+    int batch_size = 0;
+    int epochs = 5;
+    PointOrder order = PointOrder::FILE;
+    std::string places;
+    std::string bind = "close";
+    bool replicate_centroids = false;
+    std::string telemetry;
+    bool hardware_counters = false;
+    BenchmarkFormat format = BenchmarkFormat::TEXT;
+    std::string output;
+};
+
+/**
+ * Statistics of the timed runs, in seconds
+ **/
+struct TimingSummary {
+    double median = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    double mean = 0.0;
+    double stddev = 0.0;
+};
+
+/**
+ * Measurements of one data set with one thread count
+ **/
+struct BenchmarkRecord {
+    std::string program;
+    std::string precision;
+    std::string engine;
+    std::string dataset;
+    std::string affinity;
+    std::string numa;
+    int points = 0;
+    int dim = 0;
+    int clusters = 0;
+    int ranks = 1;
+    int threads = 1;
+    int warmup = 0;
+    int repetitions = 0;
+    int n_init = 1;
+    TimingSummary time;
+    KMeansResult result;
+};
+
+/**
+ * Median, extremes, mean and sample standard deviation of a list of times
+ *
+ * @param seconds duration of every timed run
+ *
+ * @return summary of the times, all zero if there are none
+ **/
+inline TimingSummary summarize_times(std::vector<double> seconds) {
+    TimingSummary summary;
+    const int n = seconds.size();
+    if (n == 0) return summary;
+
+    std::sort(seconds.begin(), seconds.end());
+    summary.min = seconds.front();
+    summary.max = seconds.back();
+    summary.median = n % 2 ? seconds[n / 2] : 0.5 * (seconds[n / 2 - 1] + seconds[n / 2]);
+
+    double sum = 0.0;
+    for (double s : seconds) sum += s;
+    summary.mean = sum / n;
+
+    double squares = 0.0;
+    for (double s : seconds) squares += (s - summary.mean) * (s - summary.mean);
+    summary.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0.0;
+    return summary;
+}
+
+/**
+ * Runs a function warmup times without timing it and then times it repetitions times
+ *
+ * @param warmup untimed runs
+ * @param repetitions timed runs
+ * @param run function to measure
+ *
+ * @return duration of every timed run in seconds
+ **/
+template <typename Run>
+std::vector<double> time_runs(const int warmup, const int repetitions, Run run) {
+    for (int i = 0; i < warmup; i++) {
+        run();
+    }
+
+    std::vector<double> seconds;
+    for (int i = 0; i < repetitions; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return seconds;
+}
+
+/**
+ * Thread counts swept by default: 1, half, all and twice the available hardware threads
+ **/
+inline std::vector<int> default_thread_counts() {
+#ifdef _OPENMP
+    const int cores = omp_get_max_threads();
+#else
+    const int cores = 1;
+#endif
+    std::vector<int> threads;
+    for (int t : {1, cores / 2, cores, 2 * cores}) {
+        if (t > 0 && std::find(threads.begin(), threads.end(), t) == threads.end()) {
+            threads.push_back(t);
+        }
+    }
+    return threads;
+}
+
+/**
+ * Binds every thread of the current OpenMP team size to one cpu of the process, round robin over
+ * the cpus the process was allowed to use at startup. If the runtime already binds its threads
+ * (OMP_PROC_BIND / OMP_PLACES) that binding is kept.
+ *
+ * @param enabled whether to bind the threads
+ *
+ * @return affinity in effect: "omp_proc_bind", "pinned" or "none"
+ **/
+inline const char* pin_threads(const bool enabled) {
+#ifdef _OPENMP
+    if (omp_get_proc_bind() != omp_proc_bind_false) return "omp_proc_bind";
+    if (!enabled) return "none";
+
+    // Taken once, before the main thread is bound to its first cpu
+    static const std::vector<int> cpus = [] {
+        std::vector<int> allowed;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &set)) allowed.push_back(cpu);
+            }
+        }
+        return allowed;
+    }();
+    if (cpus.empty()) return "none";
+
+    bool pinned = true;
+    #pragma omp parallel reduction(&&:pinned)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[omp_get_thread_num() % cpus.size()], &set);
+        pinned = sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+    return pinned ? "pinned" : "none";
+#else
+    (void)enabled;
+    return "none";
+#endif
+}
+
+/**
+ * Csv files named <N>_data.csv in a directory, ordered by N
+ *
+ * @param directory directory to search
+ *
+ * @return paths of the files
+ **/
+inline std::vector<std::string> find_input_files(const std::string& directory) {
+    std::vector<std::pair<long, std::string>> found;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        std::string name = entry.path().filename().string();
+        const std::string suffix = "_data.csv";
+        if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) continue;
+        long points = std::strtol(name.c_str(), nullptr, 10);
+        found.push_back({points, entry.path().string()});
+    }
+    std::sort(found.begin(), found.end());
+
+    std::vector<std::string> files;
+    for (const auto& file : found) {
+        files.push_back(file.second);
+    }
+    return files;
+}
+
+/**
+ * Parses a comma separated list of integers
+ *
+ * @param text list such as "1,2,4"
+ *
+ * @return the integers of the list
+ **/
+inline std::vector<int> parse_int_list(const std::string& text) {
+    std::vector<int> values;
+    std::size_t begin = 0;
+    while (begin <= text.size()) {
+        std::size_t end = text.find(',', begin);
+        if (end == std::string::npos) end = text.size();
+        if (end > begin) values.push_back(std::stoi(text.substr(begin, end - begin)));
+        begin = end + 1;
+    }
+    return values;
+}
+
+/**
+ * Prints the command line options of the benchmark
+ *
+ * @param program name of the executable
+ **/
+inline void print_benchmark_usage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --input FILE          csv to cluster (repeatable); default: every inputFiles/N_data.csv\n"
+              << "  --generate N[,D[,K]]  synthetic data set of N points, dimension D and K blobs (repeatable)\n"
+              << "  --spread S            standard deviation of the synthetic blobs (0.05)\n"
+              << "  --seed S              seed of the synthetic data and of the centroid seeding (0)\n"
+              << "  --clusters K          centroids used by k-means (5)\n"
+              << "  --threads T1,T2,...   thread counts to sweep (1, half, all and twice the cores)\n"
+              << "  --warmup W            untimed runs per thread count (1)\n"
+              << "  --repetitions R       timed runs per thread count (10)\n"
+              << "  --no-pin              do not bind threads to cpus\n"
+              << "  --no-results          do not write the <name>_results.csv assignments\n"
+              << "  --binary-results      write only the assignments as int32 to <name>_assignments.bin\n"
+              << "  --float32             cluster in single precision\n"
+              << "  --engine E            brute_force, hamerly, kd_tree or gemm\n"
+              << "  --check-kd-tree       compare a block of k-d tree labels with brute force every iteration\n"
+              << "  --n-init N            restarts per clustering, keeping the lowest inertia (1)\n"
+              << "  --order O             file, morton or hilbert: sort the points along a space-filling curve (file)\n"
+              << "  --mini-batch B        stream the --input files in batches of B points (mini-batch k-means)\n"
+              << "  --epochs E            passes over the file of the mini-batch k-means (5)\n"
+              << "  --sweep KMAX          cluster with every k from --clusters to KMAX, each warm-started from the previous one\n"
+              << "  --places P            restart with OMP_PLACES=P (threads, cores, sockets) and OMP_PROC_BIND\n"
+              << "  --bind B              OMP_PROC_BIND used with --places (close)\n"
+              << "  --numa-replicas       keep a copy of the centroids on every NUMA node\n"
+              << "  --telemetry FILE      write per-iteration phase times of the last timed run to FILE\n"
+              << "  --perf-counters       add cycles and LLC misses of every phase to the telemetry\n"
+              << "  --format F            text, csv or json (text)\n"
+              << "  --output FILE         write the records to FILE instead of the standard output\n";
+}
+
+/**
+ * Reads the benchmark settings from the command line
+ *
+ * @param argc number of arguments
+ * @param argv arguments
+ * @param options settings to fill
+ *
+ * @return false if the arguments are invalid or help was requested
+ **/
+inline bool parse_benchmark_args(const int argc, char* argv[], BenchmarkOptions& options) {
+    double spread = SyntheticOptions().spread;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) throw std::invalid_argument(arg + " needs a value");
+                return argv[++i];
+            };
+
+            if (arg == "--input") options.inputs.push_back(value());
+            else if (arg == "--generate") {
+                std::vector<int> shape = parse_int_list(value());
+                if (shape.empty()) throw std::invalid_argument("--generate needs the number of points");
+                SyntheticOptions synthetic;
+                synthetic.size = shape[0];
+                if (shape.size() > 1) synthetic.dim = shape[1];
+                if (shape.size() > 2) synthetic.clusters = shape[2];
+                options.synthetic.push_back(synthetic);
+            }
+            else if (arg == "--spread") spread = std::stod(value());
+            else if (arg == "--seed") options.seed = std::stoull(value());
+            else if (arg == "--clusters") options.clusters = std::stoi(value());
+            else if (arg == "--threads") options.threads = parse_int_list(value());
+            else if (arg == "--warmup") options.warmup = std::stoi(value());
+            else if (arg == "--repetitions") options.repetitions = std::stoi(value());
+            else if (arg == "--no-pin") options.pin = false;
+            else if (arg == "--no-results") options.write_results = false;
+            else if (arg == "--binary-results") options.binary_results = true;
+            else if (arg == "--float32") options.float32 = true;
+            else if (arg == "--engine") options.engine = value();
+            else if (arg == "--check-kd-tree") options.check_kd_tree = true;
+            else if (arg == "--n-init") options.n_init = std::stoi(value());
+            else if (arg == "--sweep") options.sweep = std::stoi(value());
+            else if (arg == "--mini-batch") options.batch_size = std::stoi(value());
+            else if (arg == "--epochs") options.epochs = std::stoi(value());
+            else if (arg == "--places") options.places = value();
+            else if (arg == "--bind") options.bind = value();
+            else if (arg == "--numa-replicas") options.replicate_centroids = true;
+            else if (arg == "--telemetry") options.telemetry = value();
+            else if (arg == "--perf-counters") options.hardware_counters = true;
+            else if (arg == "--format") {
+                std::string format = value();
+                if (format == "text") options.format = BenchmarkFormat::TEXT;
+                else if (format == "csv") options.format = BenchmarkFormat::CSV;
+                else if (format == "json") options.format = BenchmarkFormat::JSON;
+                else throw std::invalid_argument("unknown format " + format);
+            }
+            else if (arg == "--order") {
+                std::string order = value();
+                if (order == "file") options.order = PointOrder::FILE;
+                else if (order == "morton") options.order = PointOrder::MORTON;
+                else if (order == "hilbert") options.order = PointOrder::HILBERT;
+                else throw std::invalid_argument("unknown order " + order);
+            }
+            else if (arg == "--output") options.output = value();
+            else if (arg == "--help" || arg == "-h") {
+                print_benchmark_usage(argv[0]);
+                return false;
+            }
+            else throw std::invalid_argument("unknown option " + arg);
+        }
+    }
+    catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        print_benchmark_usage(argv[0]);
+        return false;
+    }
+
+    for (SyntheticOptions& synthetic : options.synthetic) {
+        synthetic.spread = spread;
+        synthetic.seed = options.seed;
+    }
+    if (options.inputs.empty() && options.synthetic.empty()) {
+        options.inputs = find_input_files("./inputFiles");
+    }
+    if (options.threads.empty() && (options.sweep > 0 || options.batch_size > 0)) {
+        // A sweep selects k and a stream is read once, so by default they run once with all the threads
+#ifdef _OPENMP
+        options.threads = {omp_get_max_threads()};
+#else
+        options.threads = {1};
+#endif
+    }
+    if (options.threads.empty()) {
+        options.threads = default_thread_counts();
+    }
+    options.warmup = std::max(options.warmup, 0);
+    options.repetitions = std::max(options.repetitions, 1);
+    return true;
+}
+
+/**
+ * Writes one record as a readable line
+ **/
+inline void write_record_text(std::ostream& out, const BenchmarkRecord& record) {
+    out << "- " << record.dataset << " (";
+    if (record.ranks > 1) out << record.ranks << " ranks x ";
+    out << record.threads << " threads): median " << record.time.median
+        << " s, min " << record.time.min << " s, stddev " << record.time.stddev << " s"
+        << " [" << record.result.iterations << " iterations, " << stop_reason_name(record.result.reason)
+        << ", inertia " << record.result.inertia << "]\n";
+}
+
+/**
+ * Writes one record of a k sweep as a readable line
+ **/
+inline void write_sweep_text(std::ostream& out, const BenchmarkRecord& record) {
+    out << "- " << record.dataset << " k=" << record.clusters << " (" << record.threads << " threads): "
+        << record.time.median << " s [" << record.result.iterations << " iterations, "
+        << stop_reason_name(record.result.reason) << ", inertia " << record.result.inertia << "]\n";
+}
+
+/**
+ * Text as a JSON string literal
+ **/
+inline std::string json_quoted(const std::string& text) {
+    std::string escaped = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+/**
+ * Writes the benchmark records in the requested format
+ *
+ * @param out stream where the records are written
+ * @param records measurements to write
+ * @param format format of the records
+ **/
+inline void write_records(std::ostream& out, const std::vector<BenchmarkRecord>& records, const BenchmarkFormat format) {
+    out << std::setprecision(9);
+    if (format == BenchmarkFormat::TEXT) {
+        for (const BenchmarkRecord& record : records) {
+            write_record_text(out, record);
+        }
+    }
+    else if (format == BenchmarkFormat::CSV) {
+        out << "program,precision,engine,n_init,dataset,points,dim,clusters,ranks,threads,affinity,numa,warmup,repetitions,"
+            << "median_s,min_s,max_s,mean_s,stddev_s,iterations,stop_reason,inertia\n";
+        for (const BenchmarkRecord& r : records) {
+            out << r.program << "," << r.precision << "," << r.engine << "," << r.n_init << "," << r.dataset << "," << r.points << ","
+                << r.dim << "," << r.clusters << "," << r.ranks << "," << r.threads << "," << r.affinity << "," << r.numa << "," << r.warmup << ","
+                << r.repetitions << "," << r.time.median << "," << r.time.min << "," << r.time.max << ","
+                << r.time.mean << "," << r.time.stddev << "," << r.result.iterations << ","
+                << stop_reason_name(r.result.reason) << "," << r.result.inertia << "\n";
+        }
+    }
+    else {
+        out << "[\n";
+        for (std::size_t i = 0; i < records.size(); i++) {
+            const BenchmarkRecord& r = records[i];
+            out << "  {\"program\": " << json_quoted(r.program) << ", \"precision\": " << json_quoted(r.precision)
+                << ", \"engine\": " << json_quoted(r.engine) << ", \"n_init\": " << r.n_init << ", \"dataset\": " << json_quoted(r.dataset)
+                << ", \"points\": " << r.points << ", \"dim\": " << r.dim << ", \"clusters\": " << r.clusters
+                << ", \"ranks\": " << r.ranks << ", \"threads\": " << r.threads << ", \"affinity\": " << json_quoted(r.affinity) << ", \"numa\": " << json_quoted(r.numa)
+                << ", \"warmup\": " << r.warmup << ", \"repetitions\": " << r.repetitions
+                << ", \"median_s\": " << r.time.median << ", \"min_s\": " << r.time.min << ", \"max_s\": " << r.time.max
+                << ", \"mean_s\": " << r.time.mean << ", \"stddev_s\": " << r.time.stddev
+                << ", \"iterations\": " << r.result.iterations
+                << ", \"stop_reason\": " << json_quoted(stop_reason_name(r.result.reason))
+                << ", \"inertia\": " << r.result.inertia << "}" << (i + 1 < records.size() ? "," : "") << "\n";
+        }
+        out << "]\n";
+    }
+}
+
+/**
+ * Writes the iteration telemetry of every record, one row (or JSON object) per iteration, as JSON
+ * when the records are JSON and as csv otherwise. Hardware counts are -1 when they were not taken.
+ *
+ * @param out stream where the telemetry is written
+ * @param records measurements whose results carry the telemetry
+ * @param format format of the records
+ **/
+inline void write_telemetry(std::ostream& out, const std::vector<BenchmarkRecord>& records, const BenchmarkFormat format) {
+    out << std::setprecision(9);
+    const bool json = format == BenchmarkFormat::JSON;
+    if (json) {
+        out << "[";
+    }
+    else {
+        out << "program,dataset,threads,iteration,changed,shift,inertia";
+        for (int phase = 0; phase < NUM_PHASES; phase++) {
+            out << "," << phase_name(phase) << "_s," << phase_name(phase) << "_cycles," << phase_name(phase) << "_llc_misses";
+        }
+        out << "\n";
+    }
+
+    bool first = true;
+    for (const BenchmarkRecord& r : records) {
+        for (const IterationRecord& it : r.result.telemetry) {
+            if (json) {
+                out << (first ? "\n" : ",\n") << "  {\"program\": " << json_quoted(r.program) << ", \"dataset\": " << json_quoted(r.dataset)
+                    << ", \"threads\": " << r.threads << ", \"iteration\": " << it.iteration << ", \"changed\": " << it.changed
+                    << ", \"shift\": " << it.shift << ", \"inertia\": " << it.inertia;
+                for (int phase = 0; phase < NUM_PHASES; phase++) {
+                    out << ", \"" << phase_name(phase) << "_s\": " << it.seconds[phase]
+                        << ", \"" << phase_name(phase) << "_cycles\": " << it.counts[phase].cycles
+                        << ", \"" << phase_name(phase) << "_llc_misses\": " << it.counts[phase].llc_misses;
+                }
+                out << "}";
+            }
+            else {
+                out << r.program << "," << r.dataset << "," << r.threads << "," << it.iteration << "," << it.changed << ","
+                    << it.shift << "," << it.inertia;
+                for (int phase = 0; phase < NUM_PHASES; phase++) {
+                    out << "," << it.seconds[phase] << "," << it.counts[phase].cycles << "," << it.counts[phase].llc_misses;
+                }
+                out << "\n";
+            }
+            first = false;
+        }
+    }
+    if (json) out << "\n]\n";
+}
+
+/**
+ * Writes the records where the options ask for them: nothing for text on the standard output (it
+ * was already printed as progress), otherwise the standard output or the output file. The iteration
+ * telemetry goes to its own file when requested.
+ *
+ * @param options benchmark settings
+ * @param records measurements to write
+ *
+ * @return 0 on success, -1 if the output or telemetry file could not be written
+ **/
+inline int write_benchmark_output(const BenchmarkOptions& options, const std::vector<BenchmarkRecord>& records) {
+    if (!options.telemetry.empty()) {
+        std::ofstream file(options.telemetry);
+        write_telemetry(file, records, options.format);
+        if (!file) {
+            std::cerr << "Error: could not write " << options.telemetry << std::endl;
+            return -1;
+        }
+    }
+    if (options.format == BenchmarkFormat::TEXT && options.output.empty()) {
+        return 0;
+    }
+    if (options.output.empty()) {
+        write_records(std::cout, records, options.format);
+        return 0;
+    }
+    std::ofstream file(options.output);
+    write_records(file, records, options.format);
+    if (!file) {
+        std::cerr << "Error: could not write " << options.output << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Name of a data set file without its directory, extension and _data suffix
+ *
+ * @param filename path of the file
+ *
+ * @return short name, e.g. 100000 for ./inputFiles/100000_data.csv
+ **/
+inline std::string dataset_name(const std::string& filename) {
+    std::string name = std::filesystem::path(filename).stem().string();
+    const std::string suffix = "_data";
+    if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        name.erase(name.size() - suffix.size());
+    }
+    return name;
+}
+
+/**
+ * Name of a generated data set, e.g. synthetic_100000x2_k5_s0
+ **/
+inline std::string synthetic_name(const SyntheticOptions& synthetic) {
+    return "synthetic_" + std::to_string(synthetic.size) + "x" + std::to_string(synthetic.dim)
+           + "_k" + std::to_string(synthetic.clusters) + "_s" + std::to_string(synthetic.seed);
+}
+
+/**
+ * Binary point file that may sit next to a csv, e.g. inputFiles/100000_data.bin
+ **/
+inline std::string binary_sibling(const std::string& filename) {
+    return filename.substr(0, filename.rfind('.')) + ".bin";
+}
+
+/**
+ * Reads or generates data set d of the options, the input files first and then the synthetic ones,
+ * and sorts its points in the order of the options
+ *
+ * @tparam T type of the coordinates
+ * @param options benchmark settings
+ * @param d index of the data set
+ * @param load reads a file into a point set, bool load(const std::string&, BasicPointSet<T>&)
+ * @param data point set to fill
+ * @param name where the name of the data set is stored
+ * @param permutation where the original index of every point is stored, empty if the points keep their order
+ * @param log stream for the progress messages
+ *
+ * @return false if the data set could not be read
+ **/
+template <typename T, typename Load>
+bool load_dataset(const BenchmarkOptions& options, const int d, Load load, BasicPointSet<T>& data, std::string& name,
+                  std::vector<int>& permutation, std::ostream& log) {
+    auto start = std::chrono::steady_clock::now();
+    if (d < (int)options.inputs.size()) {
+        const std::string& input_filename = options.inputs[d];
+        name = dataset_name(input_filename);
+
+        // A binary copy made with csv_to_bin is mapped in place instead of parsing the csv
+        std::string binary_filename = binary_sibling(input_filename);
+        bool loaded = access(binary_filename.c_str(), R_OK) == 0 && load(binary_filename, data);
+        if (!loaded && !load(input_filename, data)) {
+            free_points(data);
+            return false;
+        }
+    }
+    else {
+        const SyntheticOptions& synthetic = options.synthetic[d - options.inputs.size()];
+        generate_clustered_points(data, synthetic);
+        name = synthetic_name(synthetic);
+    }
+    order_points(data, options.order, permutation);
+    log << "- " << name << ": " << data.size << " points of dimension " << data.dim << " ready in "
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s";
+    if (!permutation.empty()) {
+        log << " (" << point_order_name(options.order) << " order)";
+    }
+    log << "\n";
+    return true;
+}
+
+/**
+ * Writes the assignments of a data set, as <name>_results.csv or as <name>_assignments.bin
+ *
+ * @param options benchmark settings
+ * @param name name of the data set
+ * @param data points of the data set
+ * @param cluster_assignments assigned cluster for each point
+ * @param permutation original index of every point, empty if the points kept their order
+ * @param write stores the points and their assignments as csv, write(const std::string&, const BasicPointSet<T>&, int*)
+ * @param log stream for the progress messages
+ **/
+template <typename T, typename Write>
+void write_dataset_results(const BenchmarkOptions& options, const std::string& name, const BasicPointSet<T>& data,
+                           int* cluster_assignments, const std::vector<int>& permutation, Write write, std::ostream& log) {
+    auto start = std::chrono::steady_clock::now();
+    std::string results_filename = name + (options.binary_results ? "_assignments.bin" : "_results.csv");
+
+    // Reordered points are written back in the order they were read
+    BasicPointSet<T> original;
+    std::unique_ptr<int[]> original_assignments;
+    if (!permutation.empty()) {
+        original_assignments.reset(new int[data.size]);
+        restore_order(data, cluster_assignments, permutation, original, original_assignments.get());
+        cluster_assignments = original_assignments.get();
+    }
+    const BasicPointSet<T>& points = permutation.empty() ? data : original;
+
+    if (options.binary_results) {
+        write_assignments(results_filename, cluster_assignments, points.size);
+    }
+    else {
+        write(results_filename, points, cluster_assignments);
+    }
+    free_points(original);
+    log << "- " << name << ": results written to " << results_filename << " in "
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s\n";
+}
+
+/**
+ * Benchmark driver shared by the k-means programs. Every data set (read or generated) is clustered
+ * with every thread count: threads are pinned, the warmup runs are discarded and the timed runs are
+ * summarized into one record. Progress is printed as text while the records are collected and the
+ * records are written at the end in the requested format.
+ *
+ * @tparam T type of the coordinates
+ * @param program name stored in the records
+ * @param options benchmark settings
+ * @param load reads a file into a point set, bool load(const std::string&, BasicPointSet<T>&)
+ * @param run clusters the points, KMeansResult run(const BasicPointSet<T>&, int* cluster_assignments)
+ * @param write stores the points and their assignments as csv, write(const std::string&, const BasicPointSet<T>&, int*)
+ *
+ * @return 0 on success, -1 if the records could not be written
+ **/
+template <typename T, typename Load, typename Run, typename Write>
+int run_benchmark(const std::string& program, const BenchmarkOptions& options, Load load, Run run, Write write) {
+    const bool machine_output = options.format != BenchmarkFormat::TEXT;
+    std::ostream& log = machine_output && options.output.empty() ? std::cerr : std::cout;
+    std::vector<BenchmarkRecord> records;
+    log << program << " (" << (sizeof(T) == sizeof(float) ? "float32" : "float64") << ", " << options.engine << ")\n";
+
+    const int num_datasets = options.inputs.size() + options.synthetic.size();
+    for (int d = 0; d < num_datasets; d++) {
+        BasicPointSet<T> data;
+        std::string name;
+        std::vector<int> permutation;
+        if (!load_dataset(options, d, load, data, name, permutation, log)) {
+            continue;
+        }
+
+        std::unique_ptr<int[]> cluster_assignments(new int[data.size]);
+        first_touch(cluster_assignments.get(), data.size, -1);
+        for (int threads : options.threads) {
+#ifdef _OPENMP
+            omp_set_num_threads(threads);
+#else
+            if (threads != 1) continue;
+#endif
+            BenchmarkRecord record;
+            record.program = program;
+            record.precision = sizeof(T) == sizeof(float) ? "float32" : "float64";
+            record.engine = options.engine;
+            record.n_init = options.n_init;
+            record.dataset = name;
+            record.affinity = pin_threads(options.pin);
+            record.numa = numa_policy(options.replicate_centroids);
+            record.points = data.size;
+            record.dim = data.dim;
+            record.clusters = options.clusters;
+            record.threads = threads;
+            record.warmup = options.warmup;
+            record.repetitions = options.repetitions;
+
+            std::vector<double> seconds = time_runs(options.warmup, options.repetitions, [&] {
+                record.result = run(data, cluster_assignments.get());
+            });
+            record.time = summarize_times(seconds);
+
+            write_record_text(log, record);
+            records.push_back(record);
+        }
+
+        if (options.write_results) {
+            write_dataset_results(options, name, data, cluster_assignments.get(), permutation, write, log);
+        }
+        free_points(data);
+    }
+
+    return write_benchmark_output(options, records);
+}
+
+/**
+ * Warm-started k sweep for model selection, driven like run_benchmark(). Every data set is read
+ * once and, for every thread count, clustered from scratch with k = options.clusters and then with
+ * every k up to options.sweep, each run starting from the previous solution with its widest cluster
+ * split in two. Every k gives one record with the time, iterations and inertia of its run; the
+ * assignments of the largest k are written as results.
+ *
+ * @tparam T type of the coordinates
+ * @param program name stored in the records
+ * @param options benchmark settings
+ * @param load reads a file into a point set, bool load(const std::string&, BasicPointSet<T>&)
+ * @param start clusters the points from scratch, KMeansResult start(const BasicPointSet<T>&, int* cluster_assignments, int k)
+ * @param grow adds one centroid to the last solution, KMeansResult grow(const BasicPointSet<T>&, int* cluster_assignments)
+ * @param write stores the points and their assignments as csv, write(const std::string&, const BasicPointSet<T>&, int*)
+ *
+ * @return 0 on success, -1 if the records could not be written
+ **/
+template <typename T, typename Load, typename Start, typename Grow, typename Write>
+int run_sweep(const std::string& program, const BenchmarkOptions& options, Load load, Start start, Grow grow, Write write) {
+    const bool machine_output = options.format != BenchmarkFormat::TEXT;
+    std::ostream& log = machine_output && options.output.empty() ? std::cerr : std::cout;
+    std::vector<BenchmarkRecord> records;
+    log << program << " (" << (sizeof(T) == sizeof(float) ? "float32" : "float64") << ", " << options.engine
+        << ", k sweep " << options.clusters << " to " << options.sweep << ")\n";
+
+    const int num_datasets = options.inputs.size() + options.synthetic.size();
+    for (int d = 0; d < num_datasets; d++) {
+        BasicPointSet<T> data;
+        std::string name;
+        std::vector<int> permutation;
+        if (!load_dataset(options, d, load, data, name, permutation, log)) {
+            continue;
+        }
+
+        std::unique_ptr<int[]> cluster_assignments(new int[data.size]);
+        first_touch(cluster_assignments.get(), data.size, -1);
+        for (int threads : options.threads) {
+#ifdef _OPENMP
+            omp_set_num_threads(threads);
+#else
+            if (threads != 1) continue;
+#endif
+            const char* affinity = pin_threads(options.pin);
+            for (int k = options.clusters; k <= std::max(options.sweep, options.clusters); k++) {
+                BenchmarkRecord record;
+                record.program = program;
+                record.precision = sizeof(T) == sizeof(float) ? "float32" : "float64";
+                record.engine = options.engine;
+                record.n_init = k == options.clusters ? options.n_init : 1;
+                record.dataset = name;
+                record.affinity = affinity;
+                record.numa = numa_policy(options.replicate_centroids);
+                record.points = data.size;
+                record.dim = data.dim;
+                record.clusters = k;
+                record.threads = threads;
+                record.repetitions = 1;
+
+                std::vector<double> seconds = time_runs(0, 1, [&] {
+                    record.result = k == options.clusters ? start(data, cluster_assignments.get(), k) : grow(data, cluster_assignments.get());
+                });
+                record.time = summarize_times(seconds);
+
+                write_sweep_text(log, record);
+                records.push_back(record);
+            }
+        }
+
+        if (options.write_results) {
+            write_dataset_results(options, name, data, cluster_assignments.get(), permutation, write, log);
+        }
+        free_points(data);
+    }
+
+    return write_benchmark_output(options, records);
+}
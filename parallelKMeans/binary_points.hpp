@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "point_set.hpp"
+
+// First bytes of every binary point file
+constexpr char BINARY_POINTS_MAGIC[8] = {'K', 'M', 'P', 'O', 'I', 'N', 'T', 'S'};
+constexpr std::uint32_t BINARY_POINTS_VERSION = 1;
+
+// Type of the stored coordinates
+enum class PointType : std::uint32_t {
+    FLOAT64 = 0,
+    FLOAT32 = 1
+};
+
+/**
+ * Header of a binary point file. It is followed by dim columns of stride values each, in the same
+ * layout as a PointSet, so the file can be used in place once mapped. The header takes exactly
+ * POINT_ALIGNMENT bytes, which keeps every column aligned.
+ **/
+struct BinaryPointsHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t dtype;
+    std::uint64_t size;
+    std::uint32_t dim;
+    std::uint32_t reserved;
+    std::uint64_t stride;
+    char padding[POINT_ALIGNMENT - 40];
+};
+static_assert(sizeof(BinaryPointsHeader) == POINT_ALIGNMENT, "header must keep the columns aligned");
+
+/**
+ * Type tag stored in the header for the coordinates of a point set
+ **/
+template <typename T>
+constexpr PointType point_type();
+template <>
+constexpr PointType point_type<double>() { return PointType::FLOAT64; }
+template <>
+constexpr PointType point_type<float>() { return PointType::FLOAT32; }
+
+/**
+ * Readable name of a point type
+ **/
+inline const char* point_type_name(const std::uint32_t dtype) {
+    switch (dtype) {
+        case static_cast<std::uint32_t>(PointType::FLOAT64): return "float64";
+        case static_cast<std::uint32_t>(PointType::FLOAT32): return "float32";
+        default: return "unknown";
+    }
+}
+
+/**
+ * Whether a file name has the extension of binary point files
+ *
+ * @param filename name of the file
+ *
+ * @return true if the name ends in .bin
+ **/
+inline bool is_binary_points(const std::string& filename) {
+    return filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".bin") == 0;
+}
+
+/**
+ * Writes a point set into a binary point file, tagged with the type of its coordinates
+ *
+ * @param filename name of the file where the points will be stored
+ * @param data points to store
+ *
+ * @return false if the file could not be written
+ **/
+template <typename T>
+inline bool write_binary_points(const std::string& filename, const BasicPointSet<T>& data) {
+    BinaryPointsHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, BINARY_POINTS_MAGIC, sizeof(header.magic));
+    header.version = BINARY_POINTS_VERSION;
+    header.dtype = static_cast<std::uint32_t>(point_type<T>());
+    header.size = data.size;
+    header.dim = data.dim;
+    header.stride = data.stride;
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(data.coords), (std::streamsize)data.stride * data.dim * sizeof(T));
+    if (!file) {
+        std::cerr << "Error: could not write " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Reads one value of every page of the points in parallel, with the same static blocks as the
+ * assignment loop. Only the pages of the point set are faulted in, and pages of the file that are
+ * not cached yet are read into the NUMA node of the thread that will use them (a single-threaded
+ * MADV_WILLNEED would put them all on the node of the main thread). Cached pages keep their node.
+ *
+ * @param data mapped point set
+ **/
+template <typename T>
+inline void prefault_points(const BasicPointSet<T>& data) {
+    const long page_values = std::max<long>(sysconf(_SC_PAGESIZE) / sizeof(T), 1);
+    const long num_blocks = (data.size + ASSIGN_BLOCK - 1) / ASSIGN_BLOCK;
+    T touched = 0;
+    for (int j = 0; j < data.dim; j++) {
+        const T* x = data.column(j);
+        #pragma omp parallel for schedule(static) reduction(+:touched)
+        for (long b = 0; b < num_blocks; b++) {
+            long begin = b * ASSIGN_BLOCK;
+            long end = std::min(begin + ASSIGN_BLOCK, (long)data.size);
+            for (long i = begin; i < end; i += page_values) {
+                touched += x[i];
+            }
+            touched += x[end - 1];
+        }
+    }
+    volatile T sink = touched;
+    (void)sink;
+}
+
+/**
+ * Maps a binary point file and uses its columns in place, without copying or parsing. The mapping
+ * is private, so writes to the points never reach the file. free_points() releases the mapping.
+ * The coordinates of the file must have type T; use csv_to_bin to produce a file of the other type.
+ *
+ * With parts > 1 only the points [part * size / parts, (part + 1) * size / parts) are referenced:
+ * the columns keep the stride of the file and only the pages of that part are ever read, so every
+ * MPI rank can map the same file and touch just its own points.
+ *
+ * @param filename name of the file with the points
+ * @param data point set that will reference the mapped columns
+ * @param part index of the part to use
+ * @param parts number of parts the points are split into
+ *
+ * @return false if the file could not be mapped or is not a valid point file of type T
+ **/
+template <typename T>
+inline bool map_binary_points(const std::string& filename, BasicPointSet<T>& data, const int part = 0, const int parts = 1) {
+    data = BasicPointSet<T>();
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: could not open " << filename << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (std::size_t)info.st_size < sizeof(BinaryPointsHeader)) {
+        close(fd);
+        std::cerr << "Error: " << filename << " is not a binary point file" << std::endl;
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error: could not map " << filename << std::endl;
+        return false;
+    }
+
+    const BinaryPointsHeader* header = static_cast<const BinaryPointsHeader*>(mapping);
+    std::size_t expected = sizeof(BinaryPointsHeader) + header->stride * header->dim * sizeof(T);
+    if (std::memcmp(header->magic, BINARY_POINTS_MAGIC, sizeof(header->magic)) == 0
+        && header->version == BINARY_POINTS_VERSION
+        && header->dtype != static_cast<std::uint32_t>(point_type<T>())) {
+        std::cerr << "Error: " << filename << " stores " << point_type_name(header->dtype) << " points, expected "
+                  << point_type_name(static_cast<std::uint32_t>(point_type<T>())) << std::endl;
+        munmap(mapping, info.st_size);
+        return false;
+    }
+    if (std::memcmp(header->magic, BINARY_POINTS_MAGIC, sizeof(header->magic)) != 0
+        || header->version != BINARY_POINTS_VERSION
+        || header->stride < header->size
+        || (std::size_t)info.st_size < expected) {
+        munmap(mapping, info.st_size);
+        std::cerr << "Error: " << filename << " is not a valid point file" << std::endl;
+        return false;
+    }
+
+    const std::size_t first = header->size * part / parts;
+    const std::size_t last = header->size * (part + 1) / parts;
+    data.size = last - first;
+    data.dim = header->dim;
+    data.stride = header->stride;
+    data.coords = reinterpret_cast<T*>(static_cast<char*>(mapping) + sizeof(BinaryPointsHeader)) + first;
+    data.mapping = mapping;
+    data.mapped_bytes = info.st_size;
+    prefault_points(data);
+    return true;
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#if defined(KMEANS_BLAS)
+#include <cblas.h>
+#endif
+#include "point_set.hpp"
+#include "distance_kernels.hpp"
+
+// Points of the register tile of the blocked kernel
+constexpr int GEMM_TILE_POINTS = 4;
+// Bytes of centroid coordinates compared against a block of points before moving to the next
+// panel; sized to stay in L2 while the block streams through it
+constexpr std::size_t GEMM_PANEL_BYTES = 1 << 17;
+
+/**
+ * Squared norm of point i of a set, in the precision of the coordinates
+ *
+ * @param points point set
+ * @param i index of the point
+ *
+ * @return squared norm
+ **/
+template <typename T>
+inline T point_norm(const BasicPointSet<T>& points, const int i) {
+    T norm = 0;
+    for (int j = 0; j < points.dim; j++) {
+        T x = points.column(j)[i];
+        norm += x * x;
+    }
+    return norm;
+}
+
+/**
+ * Centroids per panel of the blocked assignment: as many as fit in GEMM_PANEL_BYTES, rounded to
+ * whole register tiles
+ *
+ * @param dim dimension of the data
+ *
+ * @return centroids per panel
+ **/
+template <typename T>
+inline int gemm_panel(const int dim) {
+    constexpr int width = 2 * Simd<T>::lanes;
+    int panel = GEMM_PANEL_BYTES / (sizeof(T) * std::max(dim, 1));
+    return std::max((panel + width - 1) / width, 1) * width;
+}
+
+/**
+ * Register tile of the blocked kernel: dot products of GEMM_TILE_POINTS points with VECTORS
+ * vectors of consecutive centroids, accumulated over every dimension without leaving registers.
+ * Both operands are read straight from the column layout: the coordinate of a point is broadcast
+ * and multiplied by the same coordinate of a vector of centroids.
+ *
+ * @tparam VECTORS vectors of centroids in the tile, 1 or 2
+ * @param points point set
+ * @param centroids current centroids; the vectors may extend into the padding after the last one
+ * @param rows index of every point of the tile
+ * @param c first centroid of the tile
+ * @param dots where the dot products are stored, point r and centroid c + l at r * VECTORS * lanes + l
+ **/
+template <int VECTORS, typename T>
+inline void gemm_tile(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int* rows, const int c, T* dots) {
+    using V = Simd<T>;
+    using Vector = typename V::Vector;
+    Vector acc[GEMM_TILE_POINTS][VECTORS];
+    #pragma GCC unroll 8
+    for (int r = 0; r < GEMM_TILE_POINTS; r++) {
+        #pragma GCC unroll 2
+        for (int v = 0; v < VECTORS; v++) {
+            acc[r][v] = V::zero();
+        }
+    }
+
+    for (int j = 0; j < points.dim; j++) {
+        const T* x = points.column(j);
+        const T* z = centroids.column(j) + c;
+        Vector zv[VECTORS];
+        #pragma GCC unroll 2
+        for (int v = 0; v < VECTORS; v++) {
+            zv[v] = V::load(z + v * V::lanes);
+        }
+        #pragma GCC unroll 8
+        for (int r = 0; r < GEMM_TILE_POINTS; r++) {
+            Vector xr = V::broadcast(x[rows[r]]);
+            #pragma GCC unroll 2
+            for (int v = 0; v < VECTORS; v++) {
+                acc[r][v] = V::multiply_add(xr, zv[v], acc[r][v]);
+            }
+        }
+    }
+
+    #pragma GCC unroll 8
+    for (int r = 0; r < GEMM_TILE_POINTS; r++) {
+        #pragma GCC unroll 2
+        for (int v = 0; v < VECTORS; v++) {
+            V::store(dots + (r * VECTORS + v) * V::lanes, acc[r][v]);
+        }
+    }
+}
+
+/**
+ * Compares the points in [begin, end) with the centroids of one panel, keeping the closest one of
+ * every point. The distances ||x||^2 - 2 x·c + ||c||^2 are finished in the epilogue of every
+ * register tile and only their running minimum is kept, so no distance matrix is stored.
+ *
+ * @param points point set
+ * @param centroids current centroids
+ * @param norms squared norm of every centroid
+ * @param begin first point to assign
+ * @param end one past the last point to assign
+ * @param first first centroid of the panel
+ * @param last one past the last centroid of the panel
+ * @param point_norms squared norm of every point, from begin
+ * @param min_distance distance to the closest centroid so far of every point, from begin
+ * @param best closest centroid so far of every point, from begin
+ **/
+template <typename T>
+inline void gemm_argmin_panel(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const T* norms, const int begin, const int end,
+                              const int first, const int last, const T* point_norms, T* min_distance, int* best) {
+#if defined(KMEANS_BLAS)
+    // The library computes the dot products of the whole block with the panel, which is the only
+    // part of the distance matrix ever stored
+    const int count = end - begin;
+    const int width = last - first;
+    thread_local std::vector<T> dots;
+    dots.resize((std::size_t)count * width);
+    if constexpr (std::is_same<T, double>::value) {
+        cblas_dgemm(CblasColMajor, CblasNoTrans, CblasTrans, count, width, points.dim, 1.0, points.coords + begin, points.stride,
+                    centroids.coords + first, centroids.stride, 0.0, dots.data(), count);
+    }
+    else {
+        cblas_sgemm(CblasColMajor, CblasNoTrans, CblasTrans, count, width, points.dim, 1.0f, points.coords + begin, points.stride,
+                    centroids.coords + first, centroids.stride, 0.0f, dots.data(), count);
+    }
+    for (int c = first; c < last; c++) {
+        const T* dot = dots.data() + (std::size_t)(c - first) * count;
+        for (int i = 0; i < count; i++) {
+            T distance = point_norms[i] + norms[c] - 2 * dot[i];
+            if (distance < min_distance[i]) {
+                min_distance[i] = distance;
+                best[i] = c;
+            }
+        }
+    }
+#else
+    if constexpr (Simd<T>::lanes > 1) {
+        using V = Simd<T>;
+        T dots[GEMM_TILE_POINTS * 2 * V::lanes];
+        for (int i = begin; i < end; i += GEMM_TILE_POINTS) {
+            // The tail of the block repeats its last point, whose results are discarded
+            int rows[GEMM_TILE_POINTS];
+            for (int r = 0; r < GEMM_TILE_POINTS; r++) {
+                rows[r] = std::min(i + r, end - 1);
+            }
+            const int num_rows = std::min(GEMM_TILE_POINTS, end - i);
+
+            for (int c = first; c < last; ) {
+                // Columns are padded to whole vectors, but not always to pairs of them
+                int width = 2 * V::lanes;
+                if (c + width <= centroids.stride) {
+                    gemm_tile<2>(points, centroids, rows, c, dots);
+                }
+                else {
+                    width = V::lanes;
+                    gemm_tile<1>(points, centroids, rows, c, dots);
+                }
+                const int valid = std::min(width, last - c);
+                for (int r = 0; r < num_rows; r++) {
+                    const int p = i + r - begin;
+                    for (int l = 0; l < valid; l++) {
+                        T distance = point_norms[p] + norms[c + l] - 2 * dots[r * width + l];
+                        if (distance < min_distance[p]) {
+                            min_distance[p] = distance;
+                            best[p] = c + l;
+                        }
+                    }
+                }
+                c += width;
+            }
+        }
+    }
+    else {
+        for (int i = begin; i < end; i++) {
+            const int p = i - begin;
+            for (int c = first; c < last; c++) {
+                T dot = 0;
+                for (int j = 0; j < points.dim; j++) {
+                    dot += points.column(j)[i] * centroids.column(j)[c];
+                }
+                T distance = point_norms[p] + norms[c] - 2 * dot;
+                if (distance < min_distance[p]) {
+                    min_distance[p] = distance;
+                    best[p] = c;
+                }
+            }
+        }
+    }
+#endif
+}
+
+/**
+ * Blocked assignment of the points in [begin, end) to their closest centroid, for high dimensions
+ * and many centroids. Distances are expanded as ||x||^2 - 2 x·c + ||c||^2, so the bulk of the work
+ * is a matrix product of the points with the centroids, tiled for registers and for the cache and
+ * with the argmin fused into its epilogue. Built with -DKMEANS_BLAS the product of every block and
+ * panel is delegated to cblas_dgemm/cblas_sgemm instead.
+ *
+ * The expansion rounds differently than the direct difference, so points almost equidistant from
+ * two centroids may get a different one than in assign_points(); ties still go to the lowest index.
+ *
+ * @param points point set
+ * @param centroids current centroids
+ * @param norms squared norm of every centroid
+ * @param begin first point to assign
+ * @param end one past the last point to assign, at most ASSIGN_BLOCK points after begin
+ * @param cluster_assignments memory where the closest centroid of each point is stored
+ *
+ * @return number of points whose cluster changed
+ **/
+template <typename T>
+inline int assign_points_gemm(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const T* norms, const int begin, const int end, int* cluster_assignments) {
+    T point_norms[ASSIGN_BLOCK];
+    T min_distance[ASSIGN_BLOCK];
+    int best[ASSIGN_BLOCK];
+    for (int i = begin; i < end; i++) {
+        point_norms[i - begin] = point_norm(points, i);
+        min_distance[i - begin] = std::numeric_limits<T>::max();
+        best[i - begin] = 0;
+    }
+
+    const int panel = gemm_panel<T>(points.dim);
+    for (int first = 0; first < centroids.size; first += panel) {
+        gemm_argmin_panel(points, centroids, norms, begin, end, first, std::min(first + panel, centroids.size), point_norms, min_distance, best);
+    }
+
+    int changed = 0;
+    for (int i = begin; i < end; i++) {
+        changed += cluster_assignments[i] != best[i - begin];
+        cluster_assignments[i] = best[i - begin];
+    }
+    return changed;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+// Why k-means stopped iterating
+enum class StopReason {
+    NOT_CONVERGED,
+    POINTS_STABLE,      // the fraction of points that changed cluster reached its tolerance
+    CENTROID_SHIFT,     // no centroid moved more than the shift tolerance
+    INERTIA_CHANGE,     // the relative change of the inertia reached its tolerance
+    MAX_ITERATIONS      // the iteration cap was hit before any other criterion
+};
+
+/**
+ * Stopping rules for k-means. A tolerance of 0 only stops at an exact fixed point (no point changed,
+ * no centroid moved, same inertia); a negative tolerance disables the criterion.
+ *
+ * max_iterations: upper bound on the number of iterations
+ * shift_tolerance: largest euclidean distance any centroid may move in a converged iteration
+ * inertia_tolerance: relative change of the inertia between iterations
+ * changed_tolerance: fraction of the points that changed cluster in the last assignment
+ **/
+struct ConvergenceCriteria {
+    int max_iterations = 300;
+    double shift_tolerance = 0.0;
+    double inertia_tolerance = -1.0;
+    double changed_tolerance = 0.0;
+};
+
+/**
+ * Measurements of the last iteration that the criteria are applied to
+ **/
+struct IterationStats {
+    int iteration = 0;
+    long changed = 0;
+    double shift = 0.0;
+    double inertia = 0.0;
+    double last_inertia = 0.0;
+};
+
+// Phases of a k-means iteration that are timed separately
+enum Phase {
+    PHASE_ASSIGN,       // assignment pass; with the fused update it also accumulates and reduces the cluster sums
+    PHASE_UPDATE,       // cluster sums (unfused update), new centroids, shift, inertia and bound updates
+    PHASE_CHECK,        // convergence criteria
+    NUM_PHASES
+};
+
+/**
+ * Hardware events counted during a phase by all the threads; -1 when counters are not in use
+ **/
+struct HardwareCounts {
+    long long cycles = -1;
+    long long llc_misses = -1;
+};
+
+/**
+ * Measurements of one k-means iteration
+ *
+ * seconds: wall time of every phase
+ * counts: hardware events of every phase
+ * changed: points that changed cluster in the assignment
+ * shift: largest centroid displacement in the update
+ * inertia: sum of squared distances after the update
+ **/
+struct IterationRecord {
+    int iteration = 0;
+    double seconds[NUM_PHASES] = {};
+    HardwareCounts counts[NUM_PHASES];
+    long changed = 0;
+    double shift = 0.0;
+    double inertia = 0.0;
+};
+
+/**
+ * Outcome of a k-means run
+ *
+ * iterations: assignment and update rounds performed
+ * reason: criterion that stopped the algorithm
+ * changed: points that changed cluster in the last assignment
+ * shift: largest centroid displacement in the last update
+ * inertia: sum of squared distances from every point to its centroid after the last update
+ * telemetry: measurements of every iteration, only filled when they are requested
+ **/
+struct KMeansResult {
+    int iterations = 0;
+    StopReason reason = StopReason::NOT_CONVERGED;
+    long changed = 0;
+    double shift = 0.0;
+    double inertia = 0.0;
+    std::vector<IterationRecord> telemetry;
+};
+
+/**
+ * Applies the convergence criteria to the last iteration
+ *
+ * @param criteria stopping rules
+ * @param stats measurements of the last iteration
+ * @param data_size total of points
+ *
+ * @return reason to stop, or NOT_CONVERGED to keep iterating
+ **/
+inline StopReason check_convergence(const ConvergenceCriteria& criteria, const IterationStats& stats, const long data_size) {
+    if (stats.iteration == 0) {
+        return StopReason::NOT_CONVERGED;
+    }
+    if (criteria.changed_tolerance >= 0.0 && stats.iteration > 1 && stats.changed <= criteria.changed_tolerance * data_size) {
+        return StopReason::POINTS_STABLE;
+    }
+    if (criteria.shift_tolerance >= 0.0 && stats.shift <= criteria.shift_tolerance) {
+        return StopReason::CENTROID_SHIFT;
+    }
+    if (criteria.inertia_tolerance >= 0.0 && stats.iteration > 1
+        && std::fabs(stats.last_inertia - stats.inertia) <= criteria.inertia_tolerance * std::fabs(stats.last_inertia)) {
+        return StopReason::INERTIA_CHANGE;
+    }
+    if (stats.iteration >= criteria.max_iterations) {
+        return StopReason::MAX_ITERATIONS;
+    }
+    return StopReason::NOT_CONVERGED;
+}
+
+/**
+ * Readable name of a stop reason
+ *
+ * @param reason stop reason
+ *
+ * @return name of the reason
+ **/
+inline const char* stop_reason_name(const StopReason reason) {
+    switch (reason) {
+        case StopReason::POINTS_STABLE: return "points_stable";
+        case StopReason::CENTROID_SHIFT: return "centroid_shift";
+        case StopReason::INERTIA_CHANGE: return "inertia_change";
+        case StopReason::MAX_ITERATIONS: return "max_iterations";
+        default: return "not_converged";
+    }
+}
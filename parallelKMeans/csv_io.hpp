@@ -0,0 +1,311 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "point_set.hpp"
+
+// Bytes of text handled by each parsing task; chunks are extended to the next newline
+constexpr std::size_t CSV_CHUNK = 1 << 20;
+
+/**
+ * Read-only memory mapping of a whole file
+ **/
+struct MappedFile {
+    const char* bytes = nullptr;
+    std::size_t size = 0;
+};
+
+/**
+ * Timing of a load, used to report parse throughput
+ **/
+struct LoadStats {
+    std::size_t bytes = 0;
+    double seconds = 0.0;
+
+    double megabytes_per_second() const { return seconds > 0.0 ? bytes / seconds / 1e6 : 0.0; }
+};
+
+/**
+ * Maps a file into memory
+ *
+ * @param filename name of the file
+ * @param file mapping of the file; empty if the file is empty or could not be opened
+ *
+ * @return false if the file could not be opened or mapped
+ **/
+inline bool map_file(const std::string& filename, MappedFile& file) {
+    file = MappedFile();
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: could not open " << filename << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        std::cerr << "Error: could not stat " << filename << std::endl;
+        return false;
+    }
+
+    if (info.st_size > 0) {
+        void* bytes = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (bytes == MAP_FAILED) {
+            close(fd);
+            std::cerr << "Error: could not map " << filename << std::endl;
+            return false;
+        }
+        madvise(bytes, info.st_size, MADV_SEQUENTIAL);
+        file.bytes = static_cast<const char*>(bytes);
+        file.size = info.st_size;
+    }
+    close(fd);
+    return true;
+}
+
+/**
+ * Releases a mapping created by map_file()
+ *
+ * @param file mapping to release
+ **/
+inline void unmap_file(MappedFile& file) {
+    if (file.bytes) {
+        munmap(const_cast<char*>(file.bytes), file.size);
+    }
+    file = MappedFile();
+}
+
+/**
+ * Start of the first line that begins at or after a byte offset
+ *
+ * @param file mapped file
+ * @param offset byte offset
+ *
+ * @return offset of the start of the line, or the size of the file
+ **/
+inline std::size_t next_line_start(const MappedFile& file, std::size_t offset) {
+    if (offset == 0 || offset >= file.size) return std::min(offset, file.size);
+    const void* newline = std::memchr(file.bytes + offset - 1, '\n', file.size - offset + 1);
+    return newline ? static_cast<const char*>(newline) - file.bytes + 1 : file.size;
+}
+
+/**
+ * Whether a line (without its newline) contains no values
+ **/
+inline bool blank_line(const char* begin, const char* end) {
+    return begin == end || (end - begin == 1 && *begin == '\r');
+}
+
+/**
+ * Number of comma separated values in the first non-empty line of a file
+ *
+ * @param file mapped file
+ *
+ * @return dimension of the points, 0 if the file has no values
+ **/
+inline int detect_dim(const MappedFile& file) {
+    const char* begin = file.bytes;
+    const char* end = file.bytes + file.size;
+    while (begin < end) {
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        const char* line_end = newline ? newline : end;
+        if (!blank_line(begin, line_end)) {
+            return std::count(begin, line_end, ',') + 1;
+        }
+        begin = line_end + 1;
+    }
+    return 0;
+}
+
+/**
+ * Counts the non-empty lines in [begin, end), i.e. the rows that may hold a point
+ *
+ * @param begin first byte
+ * @param end one past the last byte
+ *
+ * @return number of lines with values
+ **/
+inline int count_lines(const char* begin, const char* end) {
+    int lines = 0;
+    while (begin < end) {
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        const char* line_end = newline ? newline : end;
+        if (!blank_line(begin, line_end)) lines++;
+        begin = line_end + 1;
+    }
+    return lines;
+}
+
+/**
+ * Skips the spaces and tabs starting at cursor
+ **/
+inline const char* skip_blanks(const char* cursor, const char* end) {
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t')) cursor++;
+    return cursor;
+}
+
+/**
+ * Parses one line as dim comma separated values and stores them in the point set. Blanks around
+ * the values are allowed and values past the dimension of the points are ignored.
+ *
+ * @param begin first byte of the line
+ * @param end end of the line, without its newline
+ * @param data point set where the values are stored
+ * @param index index of the point
+ *
+ * @return false if the line is not a point, e.g. a header; the point is then left half written
+ **/
+template <typename T>
+inline bool parse_point(const char* begin, const char* end, BasicPointSet<T>& data, const int index) {
+    const char* cursor = begin;
+    for (int j = 0; j < data.dim; j++) {
+        if (j > 0) {
+            if (cursor == end || *cursor != ',') return false;
+            cursor++;
+        }
+        cursor = skip_blanks(cursor, end);
+        T value;
+        auto result = std::from_chars(cursor, end, value);
+        if (result.ec != std::errc()) return false;
+        data.column(j)[index] = value;
+        cursor = skip_blanks(result.ptr, end);
+    }
+    return cursor == end || *cursor == ',' || *cursor == '\r';
+}
+
+/**
+ * Parses the non-empty lines in [begin, end) as comma separated values with std::from_chars and
+ * stores them directly in the point set starting at point index. Lines that are not points keep
+ * their slot and are reported in skipped, so the caller can drop them afterwards.
+ *
+ * @param begin first byte
+ * @param end one past the last byte
+ * @param data point set where the values are stored
+ * @param index index of the first point of the chunk
+ * @param skipped indices of the slots whose line could not be parsed, in increasing order
+ *
+ * @return number of lines that could not be parsed
+ **/
+template <typename T>
+inline int parse_lines(const char* begin, const char* end, BasicPointSet<T>& data, int index, std::vector<int>& skipped) {
+    while (begin < end) {
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        const char* line_end = newline ? newline : end;
+
+        if (!blank_line(begin, line_end)) {
+            if (!parse_point(begin, line_end, data, index)) skipped.push_back(index);
+            index++;
+        }
+        begin = line_end + 1;
+    }
+    return skipped.size();
+}
+
+/**
+ * Removes the slots of lines that could not be parsed, moving the following points down so the
+ * point set keeps the order of the file. The freed cells at the end are zeroed again.
+ *
+ * @param data point set to compact
+ * @param skipped indices of the slots to remove of every chunk, in increasing order
+ * @param removed total number of slots to remove
+ **/
+template <typename T>
+inline void drop_points(BasicPointSet<T>& data, const std::vector<std::vector<int>>& skipped, const int removed) {
+    #pragma omp parallel for
+    for (int j = 0; j < data.dim; j++) {
+        T* column = data.column(j);
+        int target = 0;
+        int source = 0;
+        for (const auto& chunk : skipped) {
+            for (int index : chunk) {
+                std::move(column + source, column + index, column + target);
+                target += index - source;
+                source = index + 1;
+            }
+        }
+        std::move(column + source, column + data.size, column + target);
+        std::fill(column + data.size - removed, column + data.size, T(0));
+    }
+    data.size -= removed;
+}
+
+/**
+ * Loads a csv of points by mapping the file into memory. The file is split into newline-aligned
+ * chunks; a first parallel sweep counts the lines of every chunk to place it in the point set, and
+ * a second one parses all chunks concurrently straight into their columns. Lines that are not
+ * points, such as a header, are dropped with a warning.
+ *
+ * The file can also be loaded in parts, e.g. one per MPI rank: part p of parts holds the lines that
+ * start in bytes [p * size / parts, (p + 1) * size / parts), so every line belongs to exactly one
+ * part and the parts follow the order of the file.
+ *
+ * @tparam T type of the coordinates, values are parsed directly into it
+ * @param filename name of the file with the points
+ * @param data memory where the points will be stored
+ * @param dim number of values per line, 0 to take it from the first line of the file
+ * @param stats bytes read and time spent, may be nullptr
+ * @param part index of the part to load
+ * @param parts number of parts the file is split into
+ *
+ * @return false if the file could not be read
+ **/
+template <typename T>
+inline bool load_csv(const std::string& filename, BasicPointSet<T>& data, int dim = 0, LoadStats* stats = nullptr, const int part = 0, const int parts = 1) {
+    auto start = std::chrono::steady_clock::now();
+
+    MappedFile file;
+    if (!map_file(filename, file)) {
+        alloc_points(data, 0, std::max(dim, 0));
+        return false;
+    }
+    if (dim <= 0) {
+        dim = detect_dim(file);
+    }
+
+    const std::size_t first = next_line_start(file, file.size * part / parts);
+    const std::size_t last = next_line_start(file, file.size * (part + 1) / parts);
+    const int num_chunks = (last - first + CSV_CHUNK - 1) / CSV_CHUNK;
+    std::vector<std::size_t> bounds(num_chunks + 1);
+    for (int c = 0; c <= num_chunks; c++) {
+        bounds[c] = next_line_start(file, std::min(first + c * CSV_CHUNK, last));
+    }
+    bounds[num_chunks] = last;
+
+    std::vector<int> first_point(num_chunks + 1, 0);
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < num_chunks; c++) {
+        first_point[c + 1] = count_lines(file.bytes + bounds[c], file.bytes + bounds[c + 1]);
+    }
+    for (int c = 0; c < num_chunks; c++) {
+        first_point[c + 1] += first_point[c];
+    }
+
+    alloc_points(data, first_point[num_chunks], dim);
+
+    int errors = 0;
+    std::vector<std::vector<int>> skipped(num_chunks);
+    #pragma omp parallel for schedule(dynamic) reduction(+:errors)
+    for (int c = 0; c < num_chunks; c++) {
+        errors += parse_lines(file.bytes + bounds[c], file.bytes + bounds[c + 1], data, first_point[c], skipped[c]);
+    }
+    if (errors > 0) {
+        drop_points(data, skipped, errors);
+        std::cerr << "Warning: skipped " << errors << " lines that are not points in " << filename << std::endl;
+    }
+
+    if (stats) {
+        stats->bytes = last - first;
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    unmap_file(file);
+    return true;
+}
@@ -0,0 +1,66 @@
+#include <iostream>
+#include <string>
+#include "point_set.hpp"
+#include "csv_io.hpp"
+#include "binary_points.hpp"
+
+/**
+ * Converts a csv of points into the binary columnar format read by map_binary_points()
+ *
+ * Usage: csv_to_bin <input.csv> <output.bin> [dim] [float64|float32]
+ *
+ * The dimension is taken from the first line of the csv unless it is given (0 also detects it).
+ * The coordinates are stored as float64 unless float32 is requested.
+ **/
+template <typename T>
+int convert(const std::string& input_filename, const std::string& output_filename, const int dim);
+
+int main(int argc, char* argv[]) {
+
+    if (argc < 3) {
+        std::cout << "Usage: " << argv[0] << " <input.csv> <output.bin> [dim] [float64|float32]\n";
+        return -1;
+    }
+
+    std::string input_filename = argv[1];
+    std::string output_filename = argv[2];
+    int dim = argc > 3 ? std::stoi(argv[3]) : 0;
+    std::string type = argc > 4 ? argv[4] : "float64";
+
+    if (type == "float32") {
+        return convert<float>(input_filename, output_filename, dim);
+    }
+    if (type != "float64") {
+        std::cout << "Unknown point type " << type << ", expected float64 or float32\n";
+        return -1;
+    }
+    return convert<double>(input_filename, output_filename, dim);
+}
+
+/**
+ * Parses the csv into coordinates of type T and writes them as a binary point file
+ *
+ * @param input_filename csv with the points
+ * @param output_filename binary point file to create
+ * @param dim values per line, 0 to detect it
+ *
+ * @return 0 on success, -1 otherwise
+ **/
+template <typename T>
+int convert(const std::string& input_filename, const std::string& output_filename, const int dim) {
+    BasicPointSet<T> data;
+    LoadStats load;
+    if (!load_csv(input_filename, data, dim, &load)) {
+        return -1;
+    }
+    std::cout << "Read " << data.size << " points of dimension " << data.dim << " in " << load.seconds << " s (" << load.megabytes_per_second() << " MB/s)\n";
+
+    bool written = write_binary_points(output_filename, data);
+    free_points(data);
+    if (!written) {
+        return -1;
+    }
+
+    std::cout << "Wrote " << output_filename << " (" << point_type_name(static_cast<std::uint32_t>(point_type<T>())) << ")\n";
+    return 0;
+}
@@ -0,0 +1,492 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <immintrin.h>
+#include "point_set.hpp"
+#include "convergence.hpp"
+
+// Average points per run of one cluster from which a block is accumulated run by run
+constexpr int ACCUMULATE_RUN_LENGTH = 8;
+
+/**
+ * Vector operations used by the assignment kernel for each coordinate type. The primary template
+ * has no lanes, which makes the kernels use their scalar loop only.
+ **/
+template <typename T>
+struct Simd {
+    static constexpr int lanes = 1;
+};
+
+#if defined(__AVX512F__)
+template <>
+struct Simd<double> {
+    using Vector = __m512d;
+    static constexpr int lanes = 8;
+
+    static Vector load(const double* p) { return _mm512_loadu_pd(p); }
+    static Vector broadcast(const double value) { return _mm512_set1_pd(value); }
+    static Vector zero() { return _mm512_setzero_pd(); }
+    static void store(double* p, const Vector v) { _mm512_storeu_pd(p, v); }
+    static Vector multiply_add(const Vector a, const Vector b, const Vector sum) { return _mm512_fmadd_pd(a, b, sum); }
+    static Vector add_squared_diff(const Vector x, const Vector c, const Vector sum) {
+        Vector diff = _mm512_sub_pd(x, c);
+        return _mm512_fmadd_pd(diff, diff, sum);
+    }
+    static void keep_closer(const Vector distance, Vector& min_distance, Vector& best, const int c) {
+        __mmask8 closer = _mm512_cmp_pd_mask(distance, min_distance, _CMP_LT_OQ);
+        min_distance = _mm512_mask_blend_pd(closer, min_distance, distance);
+        best = _mm512_mask_blend_pd(closer, best, _mm512_set1_pd((double)c));
+    }
+    static int store_labels(const Vector best, int* labels) {
+        __m256i* assigned = reinterpret_cast<__m256i*>(labels);
+        // Zero-masked with every lane set: the unmasked form leaves its source undefined, which GCC
+        // reports as maybe-uninitialized
+        __m256i values = _mm512_maskz_cvtpd_epi32(0xff, best);
+        __m256i same = _mm256_cmpeq_epi32(values, _mm256_loadu_si256(assigned));
+        _mm256_storeu_si256(assigned, values);
+        return lanes - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(same)));
+    }
+};
+
+template <>
+struct Simd<float> {
+    using Vector = __m512;
+    static constexpr int lanes = 16;
+
+    static Vector load(const float* p) { return _mm512_loadu_ps(p); }
+    static Vector broadcast(const float value) { return _mm512_set1_ps(value); }
+    static Vector zero() { return _mm512_setzero_ps(); }
+    static void store(float* p, const Vector v) { _mm512_storeu_ps(p, v); }
+    static Vector multiply_add(const Vector a, const Vector b, const Vector sum) { return _mm512_fmadd_ps(a, b, sum); }
+    static Vector add_squared_diff(const Vector x, const Vector c, const Vector sum) {
+        Vector diff = _mm512_sub_ps(x, c);
+        return _mm512_fmadd_ps(diff, diff, sum);
+    }
+    static void keep_closer(const Vector distance, Vector& min_distance, Vector& best, const int c) {
+        __mmask16 closer = _mm512_cmp_ps_mask(distance, min_distance, _CMP_LT_OQ);
+        min_distance = _mm512_mask_blend_ps(closer, min_distance, distance);
+        best = _mm512_mask_blend_ps(closer, best, _mm512_set1_ps((float)c));
+    }
+    static int store_labels(const Vector best, int* labels) {
+        __m512i values = _mm512_maskz_cvtps_epi32(0xffff, best);
+        __mmask16 same = _mm512_cmpeq_epi32_mask(values, _mm512_loadu_si512(labels));
+        _mm512_storeu_si512(labels, values);
+        return lanes - __builtin_popcount(same);
+    }
+};
+#elif defined(__AVX2__)
+template <>
+struct Simd<double> {
+    using Vector = __m256d;
+    static constexpr int lanes = 4;
+
+    static Vector load(const double* p) { return _mm256_loadu_pd(p); }
+    static Vector broadcast(const double value) { return _mm256_set1_pd(value); }
+    static Vector zero() { return _mm256_setzero_pd(); }
+    static void store(double* p, const Vector v) { _mm256_storeu_pd(p, v); }
+    static Vector multiply_add(const Vector a, const Vector b, const Vector sum) {
+#if defined(__FMA__)
+        return _mm256_fmadd_pd(a, b, sum);
+#else
+        return _mm256_add_pd(_mm256_mul_pd(a, b), sum);
+#endif
+    }
+    static Vector add_squared_diff(const Vector x, const Vector c, const Vector sum) {
+        Vector diff = _mm256_sub_pd(x, c);
+#if defined(__FMA__)
+        return _mm256_fmadd_pd(diff, diff, sum);
+#else
+        return _mm256_add_pd(_mm256_mul_pd(diff, diff), sum);
+#endif
+    }
+    static void keep_closer(const Vector distance, Vector& min_distance, Vector& best, const int c) {
+        Vector closer = _mm256_cmp_pd(distance, min_distance, _CMP_LT_OQ);
+        min_distance = _mm256_blendv_pd(min_distance, distance, closer);
+        best = _mm256_blendv_pd(best, _mm256_set1_pd((double)c), closer);
+    }
+    static int store_labels(const Vector best, int* labels) {
+        __m128i* assigned = reinterpret_cast<__m128i*>(labels);
+        __m128i values = _mm256_cvtpd_epi32(best);
+        __m128i same = _mm_cmpeq_epi32(values, _mm_loadu_si128(assigned));
+        _mm_storeu_si128(assigned, values);
+        return lanes - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(same)));
+    }
+};
+
+template <>
+struct Simd<float> {
+    using Vector = __m256;
+    static constexpr int lanes = 8;
+
+    static Vector load(const float* p) { return _mm256_loadu_ps(p); }
+    static Vector broadcast(const float value) { return _mm256_set1_ps(value); }
+    static Vector zero() { return _mm256_setzero_ps(); }
+    static void store(float* p, const Vector v) { _mm256_storeu_ps(p, v); }
+    static Vector multiply_add(const Vector a, const Vector b, const Vector sum) {
+#if defined(__FMA__)
+        return _mm256_fmadd_ps(a, b, sum);
+#else
+        return _mm256_add_ps(_mm256_mul_ps(a, b), sum);
+#endif
+    }
+    static Vector add_squared_diff(const Vector x, const Vector c, const Vector sum) {
+        Vector diff = _mm256_sub_ps(x, c);
+#if defined(__FMA__)
+        return _mm256_fmadd_ps(diff, diff, sum);
+#else
+        return _mm256_add_ps(_mm256_mul_ps(diff, diff), sum);
+#endif
+    }
+    static void keep_closer(const Vector distance, Vector& min_distance, Vector& best, const int c) {
+        Vector closer = _mm256_cmp_ps(distance, min_distance, _CMP_LT_OQ);
+        min_distance = _mm256_blendv_ps(min_distance, distance, closer);
+        best = _mm256_blendv_ps(best, _mm256_set1_ps((float)c), closer);
+    }
+    static int store_labels(const Vector best, int* labels) {
+        __m256i* assigned = reinterpret_cast<__m256i*>(labels);
+        __m256i values = _mm256_cvtps_epi32(best);
+        __m256i same = _mm256_cmpeq_epi32(values, _mm256_loadu_si256(assigned));
+        _mm256_storeu_si256(assigned, values);
+        return lanes - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(same)));
+    }
+};
+#endif
+
+/**
+ * Calls kernel with the dimension as a compile-time constant for the specialized dimensions
+ * (2, 3, 4, 8 and 16), so their coordinate loops are fully unrolled. Any other dimension is
+ * passed as 0, which the kernels read as "use the runtime dimension".
+ *
+ * @param dim dimension of the data
+ * @param kernel generic callable taking a std::integral_constant<int, DIM>
+ *
+ * @return whatever the kernel returns
+ **/
+template <typename Kernel>
+inline auto dispatch_dim(const int dim, Kernel&& kernel) {
+    switch (dim) {
+        case 2: return kernel(std::integral_constant<int, 2>());
+        case 3: return kernel(std::integral_constant<int, 3>());
+        case 4: return kernel(std::integral_constant<int, 4>());
+        case 8: return kernel(std::integral_constant<int, 8>());
+        case 16: return kernel(std::integral_constant<int, 16>());
+        default: return kernel(std::integral_constant<int, 0>());
+    }
+}
+
+/**
+ * Squared euclidean distance between point i of a set and centroid c, evaluated in the precision
+ * of the coordinates. With FMA it accumulates exactly like the vector kernels, so the scalar tail
+ * and the vector body of assign_points() resolve near-ties the same way.
+ *
+ * @tparam DIM dimension of the data, 0 to read it from the point set
+ * @param points point set
+ * @param i index of the point
+ * @param centroids centroid set
+ * @param c index of the centroid
+ *
+ * @return squared distance
+ **/
+template <int DIM = 0, typename T>
+inline T squared_distance(const BasicPointSet<T>& points, const int i, const BasicPointSet<T>& centroids, const int c) {
+    const int dim = DIM > 0 ? DIM : points.dim;
+    T distance = 0;
+    #pragma GCC unroll 16
+    for (int j = 0; j < dim; j++) {
+        T diff = points.column(j)[i] - centroids.column(j)[c];
+#if defined(__FMA__)
+        distance = std::fma(diff, diff, distance);
+#else
+        distance += diff * diff;
+#endif
+    }
+    return distance;
+}
+
+/**
+ * Scalar assignment of the points in [begin, end) to their closest candidate centroid
+ *
+ * @tparam DIM dimension of the data, 0 to read it from the point set
+ * @param points point set
+ * @param centroids current centroids
+ * @param begin first point to assign
+ * @param end one past the last point to assign
+ * @param cluster_assignments memory where the closest centroid of each point is stored
+ * @param num_candidates number of candidate centroids
+ * @param candidate index of the k-th candidate, int candidate(int k), increasing with k
+ *
+ * @return number of points whose cluster changed
+ **/
+template <int DIM = 0, typename T, typename Candidate>
+inline int assign_points_scalar(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int begin, const int end, int* cluster_assignments,
+                                const int num_candidates, Candidate candidate) {
+    int changed = 0;
+    for (int i = begin; i < end; i++) {
+        T min_distance = std::numeric_limits<T>::max();
+        int best = candidate(0);
+        for (int k = 0; k < num_candidates; k++) {
+            const int c = candidate(k);
+            T distance = squared_distance<DIM>(points, i, centroids, c);
+            if (distance < min_distance) {
+                min_distance = distance;
+                best = c;
+            }
+        }
+        changed += cluster_assignments[i] != best;
+        cluster_assignments[i] = best;
+    }
+    return changed;
+}
+
+/**
+ * Assignment kernel for one dimension, see assign_points(). With a compile-time dimension the
+ * coordinates of the group of points are loaded once into registers and reused for every centroid.
+ * Only the candidate centroids are compared, see assign_points_scalar().
+ *
+ * @tparam DIM dimension of the data, 0 to read it from the point set
+ **/
+template <int DIM, typename T, typename Candidate>
+inline int assign_points_dim(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int begin, const int end, int* cluster_assignments,
+                             const int num_candidates, Candidate candidate) {
+    int changed = 0;
+    int i = begin;
+
+    if constexpr (Simd<T>::lanes > 1) {
+        using V = Simd<T>;
+        using Vector = typename V::Vector;
+
+        for (; i + V::lanes <= end; i += V::lanes) {
+            Vector x[DIM > 0 ? DIM : 1];
+            if constexpr (DIM > 0) {
+                #pragma GCC unroll 16
+                for (int j = 0; j < DIM; j++) {
+                    x[j] = V::load(points.column(j) + i);
+                }
+            }
+            Vector min_distance = V::broadcast(std::numeric_limits<T>::max());
+            Vector best = V::broadcast((T)candidate(0));
+
+            for (int k = 0; k < num_candidates; k++) {
+                const int c = candidate(k);
+                Vector distance = V::zero();
+                if constexpr (DIM > 0) {
+                    #pragma GCC unroll 16
+                    for (int j = 0; j < DIM; j++) {
+                        distance = V::add_squared_diff(x[j], V::broadcast(centroids.column(j)[c]), distance);
+                    }
+                }
+                else {
+                    for (int j = 0; j < points.dim; j++) {
+                        distance = V::add_squared_diff(V::load(points.column(j) + i), V::broadcast(centroids.column(j)[c]), distance);
+                    }
+                }
+                V::keep_closer(distance, min_distance, best, c);
+            }
+            changed += V::store_labels(best, cluster_assignments + i);
+        }
+    }
+
+    return changed + assign_points_scalar<DIM>(points, centroids, i, end, cluster_assignments, num_candidates, candidate);
+}
+
+/**
+ * Assigns the points in [begin, end) to their closest centroid using squared distances. Groups of
+ * Simd<T>::lanes points (8 doubles or 16 floats with AVX-512, 4 or 8 with AVX2) are compared against
+ * every centroid at once; the tail falls back to the scalar loop. Ties are resolved towards the
+ * lowest centroid index, same as the scalar version.
+ *
+ * @param points point set
+ * @param centroids current centroids
+ * @param begin first point to assign
+ * @param end one past the last point to assign
+ * @param cluster_assignments memory where the closest centroid of each point is stored
+ *
+ * @return number of points whose cluster changed
+ **/
+template <typename T>
+inline int assign_points(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int begin, const int end, int* cluster_assignments) {
+    return dispatch_dim(points.dim, [&](auto dim) {
+        return assign_points_dim<decltype(dim)::value>(points, centroids, begin, end, cluster_assignments, centroids.size,
+                                                       [](const int k) { return k; });
+    });
+}
+
+/**
+ * Assigns the points in [begin, end) to their closest centroid among a list of candidates, like
+ * assign_points() does among all of them
+ *
+ * @param points point set
+ * @param centroids current centroids
+ * @param candidates indices of the candidate centroids, in increasing order
+ * @param num_candidates number of candidates, at least one
+ * @param begin first point to assign
+ * @param end one past the last point to assign
+ * @param cluster_assignments memory where the closest candidate of each point is stored
+ *
+ * @return number of points whose cluster changed
+ **/
+template <typename T>
+inline int assign_points_among(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int* candidates, const int num_candidates,
+                               const int begin, const int end, int* cluster_assignments) {
+    return dispatch_dim(points.dim, [&](auto dim) {
+        return assign_points_dim<decltype(dim)::value>(points, centroids, begin, end, cluster_assignments, num_candidates,
+                                                       [candidates](const int k) { return candidates[k]; });
+    });
+}
+
+/**
+ * Accumulation kernel for one dimension, see accumulate_points()
+ *
+ * @tparam DIM dimension of the data, 0 to read it from the point set
+ **/
+template <int DIM, typename T>
+inline void accumulate_points_dim(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int begin, const int end,
+                                  const int* cluster_assignments, double* sums, long* counts, double* distances) {
+    const int dim = DIM > 0 ? DIM : points.dim;
+    const int num_centroids = centroids.size;
+    int runs = 1;
+    for (int i = begin + 1; i < end; i++) {
+        runs += cluster_assignments[i] != cluster_assignments[i - 1];
+    }
+
+    // Points stored in spatial order come in long runs of one cluster. Adding each of them straight
+    // into the sums would chain every addition through memory, so a run is added up in a register
+    // and stored once
+    if (runs * ACCUMULATE_RUN_LENGTH <= end - begin) {
+        for (int i = begin; i < end; ) {
+            const int c = cluster_assignments[i];
+            int stop = i + 1;
+            while (stop < end && cluster_assignments[stop] == c) stop++;
+            counts[c] += stop - i;
+            double squares = 0.0;
+            #pragma GCC unroll 16
+            for (int j = 0; j < dim; j++) {
+                const T* x = points.column(j);
+                const double center = centroids.column(j)[c];
+                double run = 0.0;
+                for (int p = i; p < stop; p++) {
+                    const double diff = x[p] - center;
+                    run += x[p];
+                    squares += diff * diff;
+                }
+                sums[(std::size_t)j * num_centroids + c] += run;
+            }
+            if (distances) distances[c] += squares;
+            i = stop;
+        }
+        return;
+    }
+
+    for (int i = begin; i < end; i++) {
+        counts[cluster_assignments[i]]++;
+    }
+    #pragma GCC unroll 16
+    for (int j = 0; j < dim; j++) {
+        const T* x = points.column(j);
+        double* sum = sums + (std::size_t)j * num_centroids;
+        for (int i = begin; i < end; i++) {
+            sum[cluster_assignments[i]] += x[i];
+        }
+    }
+
+    // Squared distances are accumulated in double precision, also for float coordinates
+    if (distances) {
+        for (int i = begin; i < end; i++) {
+            const int c = cluster_assignments[i];
+            double square = 0.0;
+            #pragma GCC unroll 16
+            for (int j = 0; j < dim; j++) {
+                const double diff = (double)points.column(j)[i] - centroids.column(j)[c];
+                square += diff * diff;
+            }
+            distances[c] += square;
+        }
+    }
+}
+
+/**
+ * Adds the points in [begin, end) to the running sums and counts of their assigned cluster. The
+ * sums are always kept in double precision, also for float coordinates, and follow the same column
+ * layout as the centroids: coordinate j of cluster c is sums[j * num_centroids + c]. The squared
+ * distance from every point to the centroid it was assigned to is added up per cluster as well,
+ * from which update_centroids() derives the inertia.
+ *
+ * @param points point set
+ * @param centroids centroids the points were assigned to
+ * @param begin first point to accumulate
+ * @param end one past the last point to accumulate
+ * @param cluster_assignments cluster of each point
+ * @param sums per-cluster coordinate sums
+ * @param counts per-cluster number of points
+ * @param distances per-cluster sums of squared distances, or nullptr when they are not needed
+ **/
+template <typename T>
+inline void accumulate_points(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int begin, const int end,
+                              const int* cluster_assignments, double* sums, long* counts, double* distances) {
+    dispatch_dim(points.dim, [&](auto dim) {
+        accumulate_points_dim<decltype(dim)::value>(points, centroids, begin, end, cluster_assignments, sums, counts, distances);
+    });
+}
+
+/**
+ * Fused k-means step for a block of points: assigns every point in [begin, end) to its closest
+ * centroid and accumulates it into the cluster sums while the block is still in cache.
+ *
+ * @param points point set
+ * @param centroids current centroids
+ * @param begin first point of the block
+ * @param end one past the last point of the block
+ * @param cluster_assignments memory where the closest centroid of each point is stored
+ * @param sums per-cluster coordinate sums (see accumulate_points)
+ * @param counts per-cluster number of points
+ * @param distances per-cluster sums of squared distances, or nullptr
+ *
+ * @return number of points whose cluster changed
+ **/
+template <typename T>
+inline int assign_and_accumulate(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int begin, const int end,
+                                 int* cluster_assignments, double* sums, long* counts, double* distances) {
+    int changed = assign_points(points, centroids, begin, end, cluster_assignments);
+    accumulate_points(points, centroids, begin, end, cluster_assignments, sums, counts, distances);
+    return changed;
+}
+
+/**
+ * Moves every centroid to the mean of its points and measures the update: the largest centroid
+ * displacement and the inertia. The inertia comes from the squared distances to the centroids the
+ * points were assigned to: moving a cluster of n points from c to its mean m lowers them by exactly
+ * n |m - c|^2. Unlike the total squared norm minus |sum|^2 / n per cluster, this does not cancel
+ * when the points lie far from the origin. Centroids without points keep their value.
+ *
+ * @param sums per-cluster coordinate sums
+ * @param counts per-cluster number of points
+ * @param distances per-cluster sums of squared distances to the centroids before the update
+ * @param centroids centroids to update
+ * @param stats iteration measurements where shift and inertia are stored
+ **/
+template <typename T>
+inline void update_centroids(const double* sums, const long* counts, const double* distances, BasicPointSet<T>& centroids, IterationStats& stats) {
+    const int num_centroids = centroids.size;
+    double shift = 0.0;
+    double inertia = 0.0;
+
+    for (int cen = 0; cen < num_centroids; cen++) {
+        if (counts[cen] == 0) continue;
+
+        double displacement = 0.0;
+        for (int j = 0; j < centroids.dim; j++) {
+            double mean = sums[(std::size_t)j * num_centroids + cen] / counts[cen];
+            double diff = mean - centroids.column(j)[cen];
+            displacement += diff * diff;
+            centroids.column(j)[cen] = mean;
+        }
+        shift = std::max(shift, displacement);
+        inertia += std::max(distances[cen] - counts[cen] * displacement, 0.0);
+    }
+
+    stats.shift = std::sqrt(shift);
+    stats.inertia = inertia;
+}
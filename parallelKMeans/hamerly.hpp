@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "point_set.hpp"
+#include "distance_kernels.hpp"
+
+/**
+ * Bounds kept between iterations by the Hamerly assignment. For every point, upper bounds the
+ * distance to its assigned centroid and lower bounds the distance to any other centroid. A point
+ * whose upper bound is below both its lower bound and half the distance from its centroid to the
+ * nearest other centroid cannot change cluster, so its distances are not evaluated. Bounds are kept
+ * in double precision and widened by hamerly_slack() to absorb the rounding of the distances.
+ * The per-point bounds are first touched with the blocks of the assignment loop (see first_touch()).
+ **/
+struct HamerlyState {
+    std::unique_ptr<double[]> upper;
+    std::unique_ptr<double[]> lower;
+    int capacity = 0;
+    std::vector<double> half_separation;
+    std::vector<double> moves;
+    double max_move = 0.0;
+    double second_max_move = 0.0;
+    int max_move_centroid = -1;
+};
+
+/**
+ * Relative margin applied to every bound so that rounding in the distance evaluation can never
+ * make a bound wrong, which keeps the assignments identical to the brute-force ones
+ *
+ * @tparam T type of the coordinates
+ **/
+template <typename T>
+constexpr double hamerly_slack() {
+    return 8.0 * std::numeric_limits<T>::epsilon();
+}
+
+/**
+ * Prepares the bounds for a new run: every point starts without a cluster (-1), like in the
+ * brute-force assignment, so the first iteration evaluates all its distances. The per-point
+ * arrays of a previous run are reused when they are large enough.
+ *
+ * @param state bounds to initialize
+ * @param data_size total of points
+ * @param num_centroids used centroids in the algorithm
+ * @param cluster_assignments memory where the cluster of each point is stored
+ **/
+inline void hamerly_init(HamerlyState& state, const int data_size, const int num_centroids, int* cluster_assignments) {
+    if (data_size > state.capacity) {
+        state.upper.reset(new double[data_size]);
+        state.lower.reset(new double[data_size]);
+        state.capacity = data_size;
+    }
+    first_touch(state.upper.get(), data_size, DBL_MAX);
+    first_touch(state.lower.get(), data_size, 0.0);
+    state.half_separation.assign(num_centroids, DBL_MAX);
+    state.moves.assign(num_centroids, 0.0);
+    state.max_move = 0.0;
+    state.second_max_move = 0.0;
+    state.max_move_centroid = -1;
+    std::fill(cluster_assignments, cluster_assignments + data_size, -1);
+}
+
+/**
+ * Computes half the distance from centroid c to its nearest other centroid
+ *
+ * @param centroids current centroids
+ * @param c centroid to evaluate
+ * @param state bounds where the separation is stored
+ **/
+template <typename T>
+inline void hamerly_separation(const BasicPointSet<T>& centroids, const int c, HamerlyState& state) {
+    double closest = DBL_MAX;
+    for (int other = 0; other < centroids.size; other++) {
+        if (other == c) continue;
+        closest = std::min(closest, (double)squared_distance(centroids, c, centroids, other));
+    }
+    state.half_separation[c] = closest == DBL_MAX ? DBL_MAX : 0.5 * std::sqrt(closest) * (1.0 - hamerly_slack<T>());
+}
+
+/**
+ * Records how far every centroid moved in the last update. The bounds of each point are widened
+ * by these amounts the next time hamerly_assign() visits it.
+ *
+ * @param past centroids used in the last assignment
+ * @param present updated centroids
+ * @param state bounds where the moves are stored
+ **/
+template <typename T>
+inline void hamerly_moves(const BasicPointSet<T>& past, const BasicPointSet<T>& present, HamerlyState& state) {
+    state.max_move = 0.0;
+    state.second_max_move = 0.0;
+    state.max_move_centroid = -1;
+
+    for (int c = 0; c < present.size; c++) {
+        double move = std::sqrt((double)squared_distance(past, c, present, c)) * (1.0 + hamerly_slack<T>());
+        state.moves[c] = move;
+        if (move > state.max_move) {
+            state.second_max_move = state.max_move;
+            state.max_move = move;
+            state.max_move_centroid = c;
+        }
+        else if (move > state.second_max_move) {
+            state.second_max_move = move;
+        }
+    }
+}
+
+/**
+ * Assigns the points in [begin, end) to their closest centroid, skipping the points whose bounds
+ * prove they keep their cluster. Full scans compare squared distances with the same tie rule as
+ * assign_points(), so the result matches the brute-force assignment.
+ *
+ * @param points point set
+ * @param centroids current centroids
+ * @param begin first point to assign
+ * @param end one past the last point to assign
+ * @param cluster_assignments cluster of each point, updated in place
+ * @param state bounds from the previous iteration
+ *
+ * @return number of points whose cluster changed
+ **/
+template <typename T>
+inline int hamerly_assign(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int begin, const int end, int* cluster_assignments, HamerlyState& state) {
+    constexpr double slack = hamerly_slack<T>();
+    int changed = 0;
+    for (int i = begin; i < end; i++) {
+        int assigned = cluster_assignments[i];
+        double upper = DBL_MAX;
+        double lower = 0.0;
+        double bound = 0.0;
+        if (assigned >= 0) {
+            upper = state.upper[i] + state.moves[assigned];
+            lower = state.lower[i] - (assigned == state.max_move_centroid ? state.second_max_move : state.max_move);
+            bound = std::max(state.half_separation[assigned], lower);
+            if (upper >= bound) {
+                upper = std::sqrt((double)squared_distance(points, i, centroids, assigned)) * (1.0 + slack);
+            }
+        }
+
+        // Points without a cluster yet always take the full scan
+        if (upper >= bound) {
+            T min_distance = std::numeric_limits<T>::max();
+            T second_distance = std::numeric_limits<T>::max();
+            int best = 0;
+            for (int c = 0; c < centroids.size; c++) {
+                T distance = squared_distance(points, i, centroids, c);
+                if (distance < min_distance) {
+                    second_distance = min_distance;
+                    min_distance = distance;
+                    best = c;
+                }
+                else if (distance < second_distance) {
+                    second_distance = distance;
+                }
+            }
+            changed += assigned != best;
+            assigned = best;
+            upper = std::sqrt((double)min_distance) * (1.0 + slack);
+            lower = second_distance == std::numeric_limits<T>::max() ? DBL_MAX : std::sqrt((double)second_distance) * (1.0 - slack);
+        }
+
+        cluster_assignments[i] = assigned;
+        state.upper[i] = upper;
+        state.lower[i] = lower;
+    }
+    return changed;
+}
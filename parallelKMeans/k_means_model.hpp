@@ -0,0 +1,788 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include "point_set.hpp"
+#include "distance_kernels.hpp"
+#include "blocked_distances.hpp"
+#include "seeding.hpp"
+#include "hamerly.hpp"
+#include "kd_tree.hpp"
+#include "numa.hpp"
+#include "binary_points.hpp"
+#include "convergence.hpp"
+#include "telemetry.hpp"
+
+// Per-thread partial sums are padded to this many doubles so threads never share a cache line
+constexpr int PARTIAL_PADDING = 8;
+// Below this many coordinates the restarts of n_init run concurrently on parts of the thread team
+constexpr long RESTART_SPLIT_VALUES = 1 << 20;
+
+// Ways of finding the closest centroid of every point
+enum class AssignEngine {
+    BRUTE_FORCE,    // distance from every point to every centroid
+    HAMERLY,        // distance bounds skip the points that cannot change cluster
+    KD_TREE,        // k-d tree filtering assigns whole subtrees to a centroid at once
+    GEMM            // blocked matrix product of points and centroids, for high dimensions and large k
+};
+
+/**
+ * Settings that select how k_means() runs
+ *
+ * fused_update: assign points and accumulate per-thread cluster sums in a single pass over the data
+ *               (default). When false, every centroid rescans all the points after the assignment.
+ *               The k-d tree engine always accumulates while it assigns.
+ * engine: algorithm used to assign the points; every engine but GEMM produces the same assignments,
+ *         GEMM may differ on points almost equidistant from two centroids
+ * block_bounds: the brute-force engine prunes the centroids of every block of points with the bounding
+ *               box of the block (see assign_block_bounded()); for points stored in spatial order
+ * seeding: how the initial centroids are chosen (see seeding.hpp)
+ * convergence: when to stop iterating (see convergence.hpp)
+ * n_init: independently seeded runs; the assignments with the lowest inertia are kept
+ * replicate_centroids: the assignment reads a copy of the centroids kept on the NUMA node of each thread
+ * telemetry: record the phase times and measurements of every iteration in the result
+ * hardware_counters: also count cycles and last-level cache misses of every phase (needs telemetry)
+ * check_kd_tree: with the k-d tree engine, relabel one block of ASSIGN_BLOCK points by brute force
+ *                every iteration and warn about the points the tree labelled differently (see
+ *                kd_check_labels()); a debugging aid that costs one extra block per iteration
+ **/
+struct KMeansOptions {
+    bool fused_update = true;
+    AssignEngine engine = AssignEngine::BRUTE_FORCE;
+    bool block_bounds = false;
+    SeedingOptions seeding;
+    ConvergenceCriteria convergence;
+    int n_init = 1;
+    bool replicate_centroids = false;
+    bool telemetry = false;
+    bool hardware_counters = false;
+    bool check_kd_tree = false;
+};
+
+
+/**
+ * Sums the points of every cluster rescanning all the points once per centroid; the variant used
+ * when the update is not fused with the assignment
+ *
+ * @param data provided points for the algorithm
+ * @param centroids centroids the points were assigned to
+ * @param cluster_assignments assigned cluster for each point
+ * @param sums per-cluster coordinate sums, coordinate j of cluster c at sums[j * num_centroids + c]
+ * @param counts per-cluster number of points
+ * @param distances per-cluster sums of squared distances to the centroid
+ **/
+template <typename T>
+inline void sum_per_centroid(const BasicPointSet<T>& data, const BasicPointSet<T>& centroids, const int* cluster_assignments,
+                             double* sums, long* counts, double* distances) {
+    const int dim = data.dim;
+    const int num_centroids = centroids.size;
+
+    #pragma omp parallel for
+    for (int cen = 0; cen < num_centroids; cen++) {
+        std::vector<double> sum(dim, 0.0);
+        long count = 0;
+        double squares = 0.0;
+
+        for (int point = 0; point < data.size; point++) {
+            if (cluster_assignments[point] == cen) {
+                count++;
+                for (int j = 0; j < dim; j++) {
+                    const double x = data.column(j)[point];
+                    const double diff = x - centroids.column(j)[cen];
+                    sum[j] += x;
+                    squares += diff * diff;
+                }
+            }
+        }
+
+        counts[cen] = count;
+        distances[cen] = squares;
+        for (int j = 0; j < dim; j++) {
+            sums[(std::size_t)j * num_centroids + cen] = sum[j];
+        }
+    }
+}
+
+/**
+ * Seed of every restart of n_init; the first restart uses the seed itself
+ *
+ * @param seed user seed
+ * @param restart index of the restart
+ *
+ * @return seed for the restart
+ **/
+inline std::uint64_t restart_seed(const std::uint64_t seed, const int restart) {
+    return restart == 0 ? seed : splitmix64(seed ^ splitmix64(restart));
+}
+
+
+/**
+ * Per-thread cluster sums, counts and squared distances of the fused update. The values of every
+ * thread are padded to a multiple of PARTIAL_PADDING, so threads never share a cache line
+ *
+ * sums: dim * k cluster sums per thread, laid out like the coordinates (column j holds k sums)
+ * counts, distances: k points and k squared distances to the centroid per thread
+ * sums_stride, counts_stride: values per thread in sums and in counts/distances
+ **/
+struct PartialSums {
+    std::vector<double> sums;
+    std::vector<long> counts;
+    std::vector<double> distances;
+    int sums_stride = 0;
+    int counts_stride = 0;
+
+    double* thread_sums(const int thread) { return sums.data() + (std::size_t)thread * sums_stride; }
+    long* thread_counts(const int thread) { return counts.data() + (std::size_t)thread * counts_stride; }
+    double* thread_distances(const int thread) { return distances.data() + (std::size_t)thread * counts_stride; }
+};
+
+/**
+ * Sizes the partial sums for a team of threads
+ *
+ * @param partial partial sums to size
+ * @param num_centroids used centroids in the algorithm
+ * @param dim dimension of the points
+ * @param num_threads threads of the team that runs the algorithm
+ **/
+inline void partial_sums_prepare(PartialSums& partial, const int num_centroids, const int dim, const int num_threads) {
+    partial.sums_stride = (num_centroids * dim + PARTIAL_PADDING - 1) / PARTIAL_PADDING * PARTIAL_PADDING;
+    partial.counts_stride = (num_centroids + PARTIAL_PADDING - 1) / PARTIAL_PADDING * PARTIAL_PADDING;
+    partial.sums.resize((std::size_t)num_threads * partial.sums_stride);
+    partial.counts.resize((std::size_t)num_threads * partial.counts_stride);
+    partial.distances.resize((std::size_t)num_threads * partial.counts_stride);
+}
+
+/**
+ * Clears the partial sums of the calling thread
+ **/
+inline void partial_sums_clear(PartialSums& partial) {
+    const int thread = omp_get_thread_num();
+    std::fill(partial.thread_sums(thread), partial.thread_sums(thread) + partial.sums_stride, 0.0);
+    std::fill(partial.thread_counts(thread), partial.thread_counts(thread) + partial.counts_stride, 0);
+    std::fill(partial.thread_distances(thread), partial.thread_distances(thread) + partial.counts_stride, 0.0);
+}
+
+/**
+ * Assigns the points to their closest centroid one block of ASSIGN_BLOCK points at a time. With
+ * accumulate, every block is also added to the partial sums of its thread in the same pass, while
+ * it is still in cache. Called by all the threads of a parallel region, which share out the blocks
+ * with a static schedule.
+ *
+ * @param data provided points for the algorithm
+ * @param centroids centroids read by the assignment
+ * @param cluster_assignments cluster of each point
+ * @param partial partial sums, cleared by the calling thread beforehand
+ * @param accumulate whether to accumulate the blocks
+ * @param assign assign(begin, end) assigns the points in [begin, end) and returns how many changed
+ *
+ * @return points that changed cluster in the blocks of the calling thread
+ **/
+template <typename T, typename Assign>
+inline long fused_pass(const BasicPointSet<T>& data, const BasicPointSet<T>& centroids, int* cluster_assignments, PartialSums& partial, const bool accumulate, Assign assign) {
+    const int thread = omp_get_thread_num();
+    double* thread_sums = partial.thread_sums(thread);
+    long* thread_counts = partial.thread_counts(thread);
+    double* thread_distances = partial.thread_distances(thread);
+    long changed = 0;
+
+    #pragma omp for schedule(static)
+    for (int begin = 0; begin < data.size; begin += ASSIGN_BLOCK) {
+        int end = std::min(begin + ASSIGN_BLOCK, data.size);
+        changed += assign(begin, end);
+        if (accumulate) {
+            accumulate_points(data, centroids, begin, end, cluster_assignments, thread_sums, thread_counts, thread_distances);
+        }
+    }
+    return changed;
+}
+
+/**
+ * Adds up the partial sums of all the threads of the team. Called by all the threads of a parallel
+ * region after the partial sums are complete, each reducing some of the centroids.
+ *
+ * @tparam Count type of the reduced counts, e.g. double to place them in an MPI message
+ * @param partial partial sums of the team
+ * @param num_centroids used centroids in the algorithm
+ * @param dim dimension of the points
+ * @param sums cluster sums, laid out like the partial sums of one thread
+ * @param counts points of every cluster
+ * @param distances squared distances of the points of every cluster to its centroid
+ **/
+template <typename Count>
+inline void partial_sums_reduce(const PartialSums& partial, const int num_centroids, const int dim, double* sums, Count* counts, double* distances) {
+    const int team_size = omp_get_num_threads();
+    #pragma omp for
+    for (int cen = 0; cen < num_centroids; cen++) {
+        long count = 0;
+        double squares = 0.0;
+        for (int t = 0; t < team_size; t++) {
+            count += partial.counts[(std::size_t)t * partial.counts_stride + cen];
+            squares += partial.distances[(std::size_t)t * partial.counts_stride + cen];
+        }
+        counts[cen] = count;
+        distances[cen] = squares;
+
+        for (int j = 0; j < dim; j++) {
+            double sum = 0.0;
+            for (int t = 0; t < team_size; t++) {
+                sum += partial.sums[(std::size_t)t * partial.sums_stride + (std::size_t)j * num_centroids + cen];
+            }
+            sums[(std::size_t)j * num_centroids + cen] = sum;
+        }
+    }
+}
+
+/**
+ * Buffers of one k-means run, kept between runs so that repeated fits on data of the same shape
+ * do not allocate; workspace_prepare() sizes them for a run
+ *
+ * centroids: centroids being updated, the final centroids after the run
+ * last_centroids: centroids of the previous iteration, read by the assignment
+ * partial: per-thread cluster sums, counts and squared distances of the fused update
+ * sums, counts, distances: cluster sums, counts and squared distances reduced over the threads
+ * bounds: distance bounds of the Hamerly engine
+ * filter: labels and subtree owners of the k-d tree engine
+ * norms: squared norm of every centroid for the GEMM engine, zero in the padding
+ * replicas: per-node copies of the centroids
+ **/
+template <typename T>
+struct KMeansWorkspace {
+    BasicPointSet<T> centroids;
+    BasicPointSet<T> last_centroids;
+    PartialSums partial;
+    std::vector<double> sums;
+    std::vector<long> counts;
+    std::vector<double> distances;
+    HamerlyState bounds;
+    KdFilterState filter;
+    std::vector<T> norms;
+    CentroidReplicas<T> replicas;
+};
+
+/**
+ * Sizes the buffers of a workspace for a run; they are only reallocated when the shape changes
+ *
+ * @param workspace buffers to size
+ * @param num_centroids used centroids in the algorithm
+ * @param dim dimension of the points
+ * @param num_threads threads of the team that runs the algorithm
+ **/
+template <typename T>
+inline void workspace_prepare(KMeansWorkspace<T>& workspace, const int num_centroids, const int dim, const int num_threads) {
+    if (!workspace.centroids.coords || workspace.centroids.size != num_centroids || workspace.centroids.dim != dim) {
+        free_points(workspace.centroids);
+        free_points(workspace.last_centroids);
+        alloc_points(workspace.centroids, num_centroids, dim);
+        alloc_points(workspace.last_centroids, num_centroids, dim);
+    }
+    partial_sums_prepare(workspace.partial, num_centroids, dim, num_threads);
+    workspace.sums.resize((std::size_t)num_centroids * dim);
+    workspace.counts.resize(num_centroids);
+    workspace.distances.resize(num_centroids);
+    workspace.norms.resize(workspace.centroids.stride);
+}
+
+/**
+ * Releases the buffers of a workspace
+ **/
+template <typename T>
+inline void workspace_free(KMeansWorkspace<T>& workspace) {
+    free_points(workspace.centroids);
+    free_points(workspace.last_centroids);
+    replicas_free(workspace.replicas);
+    workspace = KMeansWorkspace<T>();
+}
+
+/**
+ * Runs k-means once from the centroids chosen by options.seeding
+ *
+ * @tparam T type of the coordinates and centroids; cluster sums are always accumulated in double
+ * @param num_centroids used centroids in the algorithm
+ * @param data provided points for the algorithm
+ * @param cluster_assigments memory where the respective cluster of each point will be stored
+ * @param options algorithm variant to use
+ * @param workspace buffers of the run, reused when they already have the right shape; the final
+ *                  centroids are left in workspace.centroids
+ * @param tree k-d tree of the data, only read by the k-d tree engine
+ *
+ * @return iterations, stop reason and final measurements of the run
+ **/
+template <typename T>
+inline KMeansResult k_means_single(const int num_centroids, const BasicPointSet<T>& data, int* cluster_assignments, const KMeansOptions& options, KMeansWorkspace<T>& workspace, const KdTree<T>& tree) {
+    const int data_size = data.size;
+    const int dim = data.dim;
+
+    // Per-thread cluster sums, counts and squared distances for the fused update, and their reduction
+    workspace_prepare(workspace, num_centroids, dim, omp_get_max_threads());
+    BasicPointSet<T>& centroids = workspace.centroids;
+    BasicPointSet<T>& last_centroids = workspace.last_centroids;
+    PartialSums& partial = workspace.partial;
+    std::vector<double>& sums = workspace.sums;
+    std::vector<long>& counts = workspace.counts;
+    std::vector<double>& distances = workspace.distances;
+
+    std::fill(cluster_assignments, cluster_assignments + data_size, -1);
+
+    // Distance bounds for the pruned assignment
+    const bool hamerly = options.engine == AssignEngine::HAMERLY;
+    HamerlyState& bounds = workspace.bounds;
+    if (hamerly) {
+        hamerly_init(bounds, data_size, num_centroids, cluster_assignments);
+    }
+
+    // Filtering over the k-d tree, which accumulates the cluster sums while it assigns. Subtrees of
+    // one level of the tree are handed out to the threads
+    const bool kd_tree = options.engine == AssignEngine::KD_TREE;
+    const bool fused_update = options.fused_update || kd_tree;
+    KdFilterState& filter = workspace.filter;
+    const int task_level = kd_task_level(tree, omp_get_max_threads());
+    if (kd_tree) {
+        kd_filter_init(filter, tree, num_centroids, omp_get_max_threads());
+    }
+
+    // Centroid norms of the blocked engine, recomputed at the start of every iteration
+    const bool gemm = options.engine == AssignEngine::GEMM;
+    T* norms = workspace.norms.data();
+
+    // Centroids read by the assignment, replicated per NUMA node when requested
+    CentroidReplicas<T>& replicas = workspace.replicas;
+    if (options.replicate_centroids) {
+        replicas_init(replicas, numa_node_count());
+    }
+    else {
+        replicas_free(replicas);
+    }
+
+    // Cycle and cache miss counters of the team, only opened for the telemetry
+    PerfCounters counters;
+    if (options.telemetry && options.hardware_counters) {
+        perf_open(counters);
+    }
+    std::vector<IterationRecord> telemetry;
+
+    //Centroids initialization
+    seed_centroids(data, centroids, options.seeding);
+
+    //Update and assignment of centroids
+    IterationStats stats;
+    StopReason reason = StopReason::NOT_CONVERGED;
+    while (reason == StopReason::NOT_CONVERGED) {
+
+        IterationRecord record;
+        PhaseTimer timer(counters, record);
+        std::copy(centroids.coords, centroids.coords + (std::size_t)dim * centroids.stride, last_centroids.coords);
+        replicas.current = stats.iteration;
+        long changed = 0;
+
+        #pragma omp parallel
+        {
+            const BasicPointSet<T>& local_centroids = local_replica(replicas, last_centroids);
+            if (fused_update) {
+                partial_sums_clear(partial);
+            }
+
+            if (hamerly) {
+                #pragma omp for
+                for (int cen = 0; cen < num_centroids; cen++) {
+                    hamerly_separation(last_centroids, cen, bounds);
+                }
+            }
+
+            if (gemm) {
+                #pragma omp for
+                for (int cen = 0; cen < last_centroids.stride; cen++) {
+                    norms[cen] = cen < num_centroids ? point_norm(last_centroids, cen) : T(0);
+                }
+            }
+
+            // Filter the subtrees of the task level, each with the full candidate list
+            if (kd_tree) {
+                const int thread = omp_get_thread_num();
+                int* candidates = filter.candidates.data() + (std::size_t)thread * num_centroids * (tree.depth + 2);
+                const int first = (1 << task_level) - 1;
+                #pragma omp for schedule(dynamic) reduction(+:changed)
+                for (int node = first; node < 2 * first + 1; node++) {
+                    std::iota(candidates, candidates + num_centroids, 0);
+                    changed += kd_filter(tree, filter, local_centroids, node, candidates, num_centroids, -1,
+                                         partial.thread_sums(thread), partial.thread_counts(thread), partial.thread_distances(thread));
+                }
+            }
+            else {
+                // Assign value to centroid, one block of points per task. With the fused update every
+                // block is also accumulated into the sums of its thread in the same pass
+                long thread_changed = fused_pass(data, local_centroids, cluster_assignments, partial, fused_update, [&](int begin, int end) {
+                    if (hamerly) {
+                        return hamerly_assign(data, local_centroids, begin, end, cluster_assignments, bounds);
+                    }
+                    else if (gemm) {
+                        return assign_points_gemm(data, local_centroids, norms, begin, end, cluster_assignments);
+                    }
+                    else if (options.block_bounds) {
+                        return assign_block_bounded(data, local_centroids, begin, end, cluster_assignments);
+                    }
+                    return assign_points(data, local_centroids, begin, end, cluster_assignments);
+                });
+                #pragma omp atomic
+                changed += thread_changed;
+            }
+
+            // Reduce the partial sums of every thread
+            if (fused_update) {
+                partial_sums_reduce(partial, num_centroids, dim, sums.data(), counts.data(), distances.data());
+            }
+        }
+
+        // Sample a different block of the tree every iteration
+        if (kd_tree && options.check_kd_tree && data_size > 0) {
+            const int num_blocks = (data_size + ASSIGN_BLOCK - 1) / ASSIGN_BLOCK;
+            const int begin = stats.iteration % num_blocks * ASSIGN_BLOCK;
+            const int end = std::min(begin + ASSIGN_BLOCK, data_size);
+            const int wrong = kd_check_labels(tree, filter, last_centroids, begin, end);
+            if (wrong > 0) {
+                std::cerr << "Warning: the k-d tree mislabelled " << wrong << " of " << end - begin
+                          << " checked points in iteration " << stats.iteration + 1 << std::endl;
+            }
+        }
+
+        timer.next();
+
+        if (!fused_update) {
+            sum_per_centroid(data, last_centroids, cluster_assignments, sums.data(), counts.data(), distances.data());
+        }
+
+        stats.iteration++;
+        stats.changed = changed;
+        stats.last_inertia = stats.inertia;
+        update_centroids(sums.data(), counts.data(), distances.data(), centroids, stats);
+        if (hamerly) {
+            hamerly_moves(last_centroids, centroids, bounds);
+        }
+        timer.next();
+
+        reason = check_convergence(options.convergence, stats, data_size);
+        timer.next();
+
+        if (options.telemetry) {
+            record.iteration = stats.iteration;
+            record.changed = stats.changed;
+            record.shift = stats.shift;
+            record.inertia = stats.inertia;
+            telemetry.push_back(record);
+        }
+    }
+
+    perf_close(counters);
+
+    // The k-d tree engine labels the points in tree order
+    if (kd_tree) {
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < data_size; i++) {
+            cluster_assignments[tree.index[i]] = filter.labels[i];
+        }
+    }
+
+    KMeansResult result;
+    result.iterations = stats.iteration;
+    result.reason = reason;
+    result.changed = stats.changed;
+    result.shift = stats.shift;
+    result.inertia = stats.inertia;
+    result.telemetry.swap(telemetry);
+    return result;
+}
+
+
+/**
+ * Reusable k-means model. fit() trains the centroids, predict() labels new points against them and
+ * save()/load() keep them in a file, so a trained model can label incoming points without running
+ * the training again. The buffers of the training are kept in the model, so fitting again on data of
+ * the same shape does not allocate.
+ *
+ * With options.n_init > 1 the algorithm is restarted from differently seeded centroids and the run
+ * with the lowest inertia is kept. The inertia of every run is added up from the distance of each
+ * point to its centroid (see update_centroids()), so the comparison holds on data far from the
+ * origin. On small data sets the restarts run concurrently, each on a part of the thread team
+ * (nested parallelism); on large ones they run one after another with all the threads, since a
+ * single run already saturates the memory bandwidth.
+ *
+ * @tparam T type of the coordinates and centroids
+ **/
+template <typename T>
+class KMeans {
+public:
+    /**
+     * @param num_centroids used centroids in the algorithm
+     * @param options algorithm variant to use
+     **/
+    explicit KMeans(const int num_centroids, const KMeansOptions& options = KMeansOptions())
+        : num_centroids_(num_centroids), options_(options) {}
+
+    ~KMeans() {
+        free_points(centroids_);
+        kd_free(tree_);
+        for (RestartGroup& group : groups_) {
+            workspace_free(group.workspace);
+            free_points(group.best_centroids);
+        }
+    }
+
+    KMeans(const KMeans&) = delete;
+    KMeans& operator=(const KMeans&) = delete;
+
+    /**
+     * Trains the centroids on a set of points
+     *
+     * @param data provided points for the algorithm
+     *
+     * @return measurements of the kept run
+     **/
+    KMeansResult fit(const BasicPointSet<T>& data) {
+        labels_.resize(data.size);
+        return fit_predict(data, labels_.data());
+    }
+
+    /**
+     * Trains the centroids on a set of points and stores the cluster of each of them
+     *
+     * @param data provided points for the algorithm
+     * @param cluster_assignments memory where the respective cluster of each point will be stored
+     *
+     * @return measurements of the kept run
+     **/
+    KMeansResult fit_predict(const BasicPointSet<T>& data, int* cluster_assignments);
+
+    /**
+     * Adds one centroid and trains again, warm-started from the current solution: the cluster with
+     * the highest inertia is split in two along its main axis (see split_cluster()) and the run
+     * starts from those centroids instead of seeding new ones, so it usually needs only a few
+     * iterations. n_init is ignored. An untrained model is fitted from scratch instead.
+     *
+     * @param data points of the previous fit
+     * @param cluster_assignments clusters of the previous fit, replaced by the new ones
+     *
+     * @return measurements of the run
+     **/
+    KMeansResult grow(const BasicPointSet<T>& data, int* cluster_assignments);
+
+    /**
+     * Assigns every point to its closest trained centroid, in parallel blocks of ASSIGN_BLOCK points.
+     * The model is not modified, so several threads may predict with the same model at once.
+     *
+     * @param points points to label, of the same dimension as the model
+     * @param cluster_assignments memory where the closest centroid of each point will be stored
+     *
+     * @return false if the model is not trained or the dimensions differ
+     **/
+    bool predict(const BasicPointSet<T>& points, int* cluster_assignments) const;
+
+    /**
+     * Stores the centroids in the binary point format (see binary_points.hpp)
+     *
+     * @param filename name of the model file
+     *
+     * @return false if the model is not trained or the file could not be written
+     **/
+    bool save(const std::string& filename) const {
+        if (!trained()) {
+            std::cerr << "Error: cannot save an untrained model" << std::endl;
+            return false;
+        }
+        return write_binary_points(filename, centroids_);
+    }
+
+    /**
+     * Replaces the centroids with the ones of a model file written by save() with the same type
+     *
+     * @param filename name of the model file
+     *
+     * @return false if the file could not be read
+     **/
+    bool load(const std::string& filename) {
+        BasicPointSet<T> stored;
+        if (!map_binary_points(filename, stored)) {
+            free_points(stored);
+            return false;
+        }
+        copy_points(stored, centroids_);
+        num_centroids_ = stored.size;
+        free_points(stored);
+        return true;
+    }
+
+    bool trained() const { return centroids_.coords != nullptr; }
+    int num_centroids() const { return num_centroids_; }
+    void set_num_centroids(const int num_centroids) { num_centroids_ = num_centroids; }
+    const BasicPointSet<T>& centroids() const { return centroids_; }
+    const KMeansResult& result() const { return result_; }
+    KMeansOptions& options() { return options_; }
+
+private:
+    /**
+     * Part of the thread team that runs restarts, with its own buffers and best run so far
+     **/
+    struct RestartGroup {
+        KMeansWorkspace<T> workspace;
+        std::vector<int> assignments;
+        std::vector<int> best_assignments;
+        BasicPointSet<T> best_centroids;
+        KMeansResult best;
+        int best_restart = -1;
+    };
+
+    int num_centroids_;
+    KMeansOptions options_;
+    BasicPointSet<T> centroids_;
+    KMeansResult result_;
+    KdTree<T> tree_;
+    std::vector<int> labels_;
+    std::vector<RestartGroup> groups_;
+};
+
+template <typename T>
+KMeansResult KMeans<T>::fit_predict(const BasicPointSet<T>& data, int* cluster_assignments) {
+    const int restarts = std::max(options_.n_init, 1);
+    const int num_threads = omp_get_max_threads();
+    const int num_groups = restarts > 1 && (long)data.size * data.dim < RESTART_SPLIT_VALUES ? std::min(restarts, num_threads) : 1;
+    const int group_threads = std::max(num_threads / num_groups, 1);
+    if ((int)groups_.size() < num_groups) {
+        groups_.resize(num_groups);
+    }
+    // The tree only depends on the points, so it is built once for all the restarts
+    if (options_.engine == AssignEngine::KD_TREE) {
+        kd_build(tree_, data);
+    }
+
+    if (restarts == 1) {
+        result_ = k_means_single(num_centroids_, data, cluster_assignments, options_, groups_[0].workspace, tree_);
+        copy_points(groups_[0].workspace.centroids, centroids_);
+        return result_;
+    }
+
+    const int active_levels = omp_get_max_active_levels();
+    if (num_groups > 1) {
+        omp_set_max_active_levels(std::max(active_levels, 2));
+    }
+
+    #pragma omp parallel num_threads(num_groups)
+    {
+        RestartGroup& group = groups_[omp_get_thread_num()];
+        omp_set_num_threads(group_threads);
+        group.assignments.resize(data.size);
+        group.best_assignments.resize(data.size);
+        group.best_restart = -1;
+        KMeansOptions run_options = options_;
+        run_options.n_init = 1;
+
+        // The buffers of a better run are swapped with the best ones, so nothing is copied per restart
+        #pragma omp for schedule(dynamic)
+        for (int r = 0; r < restarts; r++) {
+            run_options.seeding.seed = restart_seed(options_.seeding.seed, r);
+            KMeansResult result = k_means_single(num_centroids_, data, group.assignments.data(), run_options, group.workspace, tree_);
+            if (group.best_restart < 0 || result.inertia < group.best.inertia) {
+                group.best = result;
+                group.best_restart = r;
+                group.best_assignments.swap(group.assignments);
+                std::swap(group.best_centroids, group.workspace.centroids);
+            }
+        }
+    }
+    omp_set_max_active_levels(active_levels);
+
+    // Lowest inertia, ties broken by the restart index so the winner does not depend on the schedule
+    int winner = -1;
+    for (int g = 0; g < num_groups; g++) {
+        const RestartGroup& group = groups_[g];
+        if (group.best_restart < 0) continue;
+        if (winner < 0 || group.best.inertia < groups_[winner].best.inertia
+            || (group.best.inertia == groups_[winner].best.inertia && group.best_restart < groups_[winner].best_restart)) {
+            winner = g;
+        }
+    }
+    const RestartGroup& best = groups_[winner];
+    std::copy(best.best_assignments.begin(), best.best_assignments.end(), cluster_assignments);
+    copy_points(best.best_centroids, centroids_);
+    result_ = best.best;
+    return result_;
+}
+
+template <typename T>
+KMeansResult KMeans<T>::grow(const BasicPointSet<T>& data, int* cluster_assignments) {
+    if (!trained()) {
+        return fit_predict(data, cluster_assignments);
+    }
+    if (groups_.empty()) {
+        groups_.resize(1);
+    }
+    // A model read with load() has no tree of the data yet
+    if (options_.engine == AssignEngine::KD_TREE && (int)tree_.index.size() != data.size) {
+        kd_build(tree_, data);
+    }
+
+    // The workspace is sized for the new number of centroids first, so the run keeps the split ones
+    KMeansWorkspace<T>& workspace = groups_[0].workspace;
+    workspace_prepare(workspace, num_centroids_ + 1, data.dim, omp_get_max_threads());
+    split_cluster(data, centroids_, cluster_assignments, workspace.centroids);
+    num_centroids_++;
+
+    KMeansOptions run_options = options_;
+    run_options.seeding.method = SeedingMethod::KEEP;
+    result_ = k_means_single(num_centroids_, data, cluster_assignments, run_options, workspace, tree_);
+    copy_points(workspace.centroids, centroids_);
+    return result_;
+}
+
+template <typename T>
+bool KMeans<T>::predict(const BasicPointSet<T>& points, int* cluster_assignments) const {
+    if (!trained()) {
+        std::cerr << "Error: cannot predict with an untrained model" << std::endl;
+        return false;
+    }
+    if (points.dim != centroids_.dim) {
+        std::cerr << "Error: the model has dimension " << centroids_.dim << " but the points have dimension " << points.dim << std::endl;
+        return false;
+    }
+
+    // The blocked engine also labels new points, which pays off with many centroids
+    const bool gemm = options_.engine == AssignEngine::GEMM;
+    std::vector<T> norms(gemm ? centroids_.stride : 0);
+    for (std::size_t cen = 0; cen < norms.size(); cen++) {
+        norms[cen] = (int)cen < centroids_.size ? point_norm(centroids_, cen) : T(0);
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int begin = 0; begin < points.size; begin += ASSIGN_BLOCK) {
+        int end = std::min(begin + ASSIGN_BLOCK, points.size);
+        std::fill(cluster_assignments + begin, cluster_assignments + end, -1);
+        if (gemm) {
+            assign_points_gemm(points, centroids_, norms.data(), begin, end, cluster_assignments);
+        }
+        else {
+            assign_points(points, centroids_, begin, end, cluster_assignments);
+        }
+    }
+    return true;
+}
+
+/**
+ * Given a set of points, assigns clusters to each points using the k-means algorithm; a one-shot
+ * KMeans::fit_predict()
+ *
+ * @tparam T type of the coordinates and centroids
+ * @param num_centroids used centroids in the algorithm
+ * @param data provided points for the algorithm
+ * @param cluster_assigments memory where the respective cluster of each point will be stored
+ * @param options algorithm variant to use
+ *
+ * @return measurements of the best run
+ **/
+template <typename T>
+inline KMeansResult k_means(const int num_centroids, const BasicPointSet<T>& data, int* cluster_assignments, const KMeansOptions& options = KMeansOptions()) {
+    KMeans<T> model(num_centroids, options);
+    return model.fit_predict(data, cluster_assignments);
+}
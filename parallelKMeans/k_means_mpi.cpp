@@ -0,0 +1,548 @@
+#include <mpi.h>
+#include <iostream>
+#include <cmath>
+#include <cfloat>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <omp.h>
+#include "point_set.hpp"
+#include "distance_kernels.hpp"
+#include "seeding.hpp"
+#include "csv_io.hpp"
+#include "binary_points.hpp"
+#include "result_writer.hpp"
+#include "convergence.hpp"
+#include "synthetic_data.hpp"
+#include "benchmark.hpp"
+#include "k_means_model.hpp"
+
+/**
+ * Part of a data set held by one rank. The ranks hold consecutive slices in rank order.
+ *
+ * points: points of this rank
+ * first: global index of the first point of this rank
+ * total: points held by all the ranks together
+ **/
+template <typename T>
+struct DistributedPointSet {
+    BasicPointSet<T> points;
+    long first = 0;
+    long total = 0;
+};
+
+template <typename T> int benchmark(const BenchmarkOptions& options, MPI_Comm comm);
+template <typename T> bool load_slice(const std::string& filename, DistributedPointSet<T>& data, MPI_Comm comm);
+template <typename T> void locate_slice(DistributedPointSet<T>& data, MPI_Comm comm);
+template <typename T> KMeansResult k_means(const int num_centroids, const DistributedPointSet<T>& data, int* cluster_assignments, const SeedingOptions& seeding, const ConvergenceCriteria& criteria, MPI_Comm comm);
+template <typename T> void seed_centroids_distributed(const DistributedPointSet<T>& data, BasicPointSet<T>& centroids, const SeedingOptions& options, MPI_Comm comm);
+template <typename T> int gather_candidates(const BasicPointSet<T>& points, const std::vector<int>& picks, std::vector<double>& candidates, MPI_Comm comm);
+template <typename T> void rows_to_points(const double* rows, const int count, const int dim, BasicPointSet<T>& points);
+template <typename T> void write_csv(const std::string& filename, const BasicPointSet<T>& data, int* cluster_assignments, MPI_Comm comm);
+template <typename T> void write_assignments(const std::string& filename, const DistributedPointSet<T>& data, int* cluster_assignments, MPI_Comm comm);
+template <typename Write> void write_parts(const std::string& filename, MPI_Comm comm, Write write);
+
+/**
+ * Benchmarks the distributed k-means: every rank loads (or generates) its own slice of each data
+ * set and the ranks cluster it together. Accepts the options of print_benchmark_usage().
+ **/
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    BenchmarkOptions options;
+    if (!parse_benchmark_args(argc, argv, options)) {
+        MPI_Finalize();
+        return -1;
+    }
+    options.engine = "brute_force";
+    options.n_init = 1;
+    options.sweep = 0;
+    options.batch_size = 0;
+    options.order = PointOrder::FILE;
+
+    int status = options.float32 ? benchmark<float>(options, MPI_COMM_WORLD) : benchmark<double>(options, MPI_COMM_WORLD);
+
+    MPI_Finalize();
+    return status;
+}
+
+/**
+ * Clusters every data set with each number of threads per rank. The time of a run is the time of
+ * the slowest rank; only rank 0 prints and writes the records.
+ *
+ * @tparam T type of the coordinates
+ * @param options benchmark settings
+ * @param comm ranks taking part
+ *
+ * @return 0 on success
+ **/
+template <typename T>
+int benchmark(const BenchmarkOptions& options, MPI_Comm comm) {
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    const bool machine_output = options.format != BenchmarkFormat::TEXT;
+    std::ostream& log = machine_output && options.output.empty() ? std::cerr : std::cout;
+    std::vector<BenchmarkRecord> records;
+    if (rank == 0) {
+        log << "k_means_mpi (" << (sizeof(T) == sizeof(float) ? "float32" : "float64") << ", " << ranks << " ranks)\n";
+    }
+
+    SeedingOptions seeding;
+    seeding.seed = options.seed;
+    ConvergenceCriteria criteria;
+
+    const int num_datasets = options.inputs.size() + options.synthetic.size();
+    for (int d = 0; d < num_datasets; d++) {
+        DistributedPointSet<T> data;
+        std::string name;
+        double start_time = MPI_Wtime();
+
+        if (d < (int)options.inputs.size()) {
+            name = dataset_name(options.inputs[d]);
+            if (!load_slice(options.inputs[d], data, comm)) {
+                free_points(data.points);
+                continue;
+            }
+        }
+        else {
+            const SyntheticOptions& synthetic = options.synthetic[d - options.inputs.size()];
+            generate_clustered_points(data.points, synthetic, rank, ranks);
+            locate_slice(data, comm);
+            name = synthetic_name(synthetic);
+        }
+        MPI_Barrier(comm);
+        if (rank == 0) {
+            log << "- " << name << ": " << data.total << " points of dimension " << data.points.dim << " ready in "
+                << MPI_Wtime() - start_time << " s\n";
+        }
+
+        std::unique_ptr<int[]> cluster_assignments(new int[data.points.size]);
+        first_touch(cluster_assignments.get(), data.points.size, -1);
+        for (int threads : options.threads) {
+            omp_set_num_threads(threads);
+
+            BenchmarkRecord record;
+            record.program = "k_means_mpi";
+            record.precision = sizeof(T) == sizeof(float) ? "float32" : "float64";
+            record.engine = options.engine;
+            record.dataset = name;
+            // Several ranks may share the cpus of a node, so threads are only bound by the runtime
+            record.affinity = pin_threads(options.pin && ranks == 1);
+            record.numa = numa_policy(false);
+            record.points = data.total;
+            record.dim = data.points.dim;
+            record.clusters = options.clusters;
+            record.ranks = ranks;
+            record.threads = threads;
+            record.warmup = options.warmup;
+            record.repetitions = options.repetitions;
+
+            std::vector<double> seconds;
+            for (int i = 0; i < options.warmup + options.repetitions; i++) {
+                MPI_Barrier(comm);
+                double run_start = MPI_Wtime();
+                record.result = k_means(options.clusters, data, cluster_assignments.get(), seeding, criteria, comm);
+                double duration = MPI_Wtime() - run_start;
+                double slowest = 0.0;
+                MPI_Reduce(&duration, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+                if (i >= options.warmup) seconds.push_back(slowest);
+            }
+
+            if (rank == 0) {
+                record.time = summarize_times(seconds);
+                write_record_text(log, record);
+                records.push_back(record);
+            }
+        }
+
+        if (options.write_results) {
+            start_time = MPI_Wtime();
+            std::string results_filename = name + (options.binary_results ? "_assignments.bin" : "_results.csv");
+            if (options.binary_results) {
+                write_assignments(results_filename, data, cluster_assignments.get(), comm);
+            }
+            else {
+                write_csv(results_filename, data.points, cluster_assignments.get(), comm);
+            }
+            MPI_Barrier(comm);
+            if (rank == 0) {
+                log << "- " << name << ": results written to " << results_filename << " in " << MPI_Wtime() - start_time << " s\n";
+            }
+        }
+        free_points(data.points);
+    }
+
+    return rank == 0 ? write_benchmark_output(options, records) : 0;
+}
+
+/**
+ * Loads the slice of a point file that belongs to this rank: a binary copy next to the csv is
+ * mapped when it exists (only the pages of the slice are read), otherwise the csv is parsed from
+ * the line boundaries that fall in the slice. Fails on every rank if it fails on any of them.
+ *
+ * @param filename csv with the points
+ * @param data slice of this rank
+ * @param comm ranks taking part
+ *
+ * @return false if some rank could not load its slice
+ **/
+template <typename T>
+bool load_slice(const std::string& filename, DistributedPointSet<T>& data, MPI_Comm comm) {
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    std::string binary_filename = binary_sibling(filename);
+    int loaded = access(binary_filename.c_str(), R_OK) == 0 && map_binary_points(binary_filename, data.points, rank, ranks);
+    if (!loaded) {
+        loaded = load_csv(filename, data.points, 0, nullptr, rank, ranks);
+    }
+
+    int all_loaded = 0;
+    MPI_Allreduce(&loaded, &all_loaded, 1, MPI_INT, MPI_MIN, comm);
+    if (!all_loaded) return false;
+
+    locate_slice(data, comm);
+    return true;
+}
+
+/**
+ * Computes the global index of the first point of every rank and the total number of points
+ *
+ * @param data slice of this rank
+ * @param comm ranks taking part
+ **/
+template <typename T>
+void locate_slice(DistributedPointSet<T>& data, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    long size = data.points.size;
+    data.first = 0;
+    MPI_Exscan(&size, &data.first, 1, MPI_LONG, MPI_SUM, comm);
+    if (rank == 0) data.first = 0;
+    MPI_Allreduce(&size, &data.total, 1, MPI_LONG, MPI_SUM, comm);
+}
+
+/**
+ * Distributed k-means: every rank assigns its own points and accumulates per-thread cluster sums
+ * in the same fused pass as the OpenMP version (see fused_pass()), then the sums, counts, squared
+ * distances and changed points of all the ranks are combined with a single MPI_Allreduce per
+ * iteration. Since every rank receives the same totals, all of them compute the same centroids and
+ * reach the same convergence decision without further messages.
+ *
+ * @tparam T type of the coordinates and centroids; cluster sums are always accumulated in double
+ * @param num_centroids used centroids in the algorithm
+ * @param data slice of the points held by this rank
+ * @param cluster_assignments memory where the cluster of each local point will be stored
+ * @param seeding how the initial centroids are chosen
+ * @param criteria when to stop iterating
+ * @param comm ranks taking part
+ *
+ * @return iterations, stop reason and final measurements of the run (the same on every rank)
+ **/
+template <typename T>
+KMeansResult k_means(const int num_centroids, const DistributedPointSet<T>& data, int* cluster_assignments, const SeedingOptions& seeding, const ConvergenceCriteria& criteria, MPI_Comm comm) {
+    const BasicPointSet<T>& points = data.points;
+    const int data_size = points.size;
+    const int dim = points.dim;
+    BasicPointSet<T> centroids, last_centroids;
+    alloc_points(centroids, num_centroids, dim);
+    alloc_points(last_centroids, num_centroids, dim);
+
+    // Per-thread cluster sums, counts and squared distances, reduced into one message: sums, then
+    // counts, then squared distances, then changed
+    PartialSums partial;
+    partial_sums_prepare(partial, num_centroids, dim, omp_get_max_threads());
+    const std::size_t counts_offset = (std::size_t)num_centroids * dim;
+    const std::size_t distances_offset = counts_offset + num_centroids;
+    std::vector<double> message(distances_offset + num_centroids + 1);
+    std::vector<long> counts(num_centroids);
+
+    std::fill(cluster_assignments, cluster_assignments + data_size, -1);
+
+    //Centroids initialization
+    seed_centroids_distributed(data, centroids, seeding, comm);
+
+    //Update and assignment of centroids
+    IterationStats stats;
+    StopReason reason = StopReason::NOT_CONVERGED;
+    while (reason == StopReason::NOT_CONVERGED) {
+
+        std::copy(centroids.coords, centroids.coords + (std::size_t)dim * centroids.stride, last_centroids.coords);
+        long changed = 0;
+
+        #pragma omp parallel
+        {
+            partial_sums_clear(partial);
+            long thread_changed = fused_pass(points, last_centroids, cluster_assignments, partial, true, [&](int begin, int end) {
+                return assign_points(points, last_centroids, begin, end, cluster_assignments);
+            });
+            #pragma omp atomic
+            changed += thread_changed;
+
+            partial_sums_reduce(partial, num_centroids, dim, message.data(), message.data() + counts_offset, message.data() + distances_offset);
+        }
+        message.back() = changed;
+
+        // Counts travel as doubles, which is exact up to 2^53 points
+        MPI_Allreduce(MPI_IN_PLACE, message.data(), message.size(), MPI_DOUBLE, MPI_SUM, comm);
+        for (int cen = 0; cen < num_centroids; cen++) {
+            counts[cen] = (long)message[counts_offset + cen];
+        }
+
+        stats.iteration++;
+        stats.changed = (long)message.back();
+        stats.last_inertia = stats.inertia;
+        update_centroids(message.data(), counts.data(), message.data() + distances_offset, centroids, stats);
+
+        reason = check_convergence(criteria, stats, data.total);
+    }
+
+    free_points(centroids);
+    free_points(last_centroids);
+
+    KMeansResult result;
+    result.iterations = stats.iteration;
+    result.reason = reason;
+    result.changed = stats.changed;
+    result.shift = stats.shift;
+    result.inertia = stats.inertia;
+    return result;
+}
+
+/**
+ * Distributed k-means|| seeding. It follows kmeans_parallel() from seeding.hpp: every point is drawn
+ * with the counter of its global index and the candidates of all the ranks are gathered in global
+ * order, so the candidates do not depend on the number of ranks. The cost of every round is a
+ * single MPI_Allreduce. The candidates are weighted by the points closest to them (another
+ * MPI_Allreduce) and every rank reduces them to the same k centroids with k-means++. RANDOM keeps
+ * its meaning; KMEANS_PLUS_PLUS also uses k-means||, since it would need one pass and one
+ * collective per centroid.
+ *
+ * @param data slice of the points held by this rank
+ * @param centroids memory where the centroids will be stored
+ * @param options seeding settings
+ * @param comm ranks taking part
+ **/
+template <typename T>
+void seed_centroids_distributed(const DistributedPointSet<T>& data, BasicPointSet<T>& centroids, const SeedingOptions& options, MPI_Comm comm) {
+    if (options.method == SeedingMethod::RANDOM || data.total == 0) {
+        SeedingOptions random = options;
+        random.method = SeedingMethod::RANDOM;
+        seed_centroids(data.points, centroids, random);
+        return;
+    }
+
+    const BasicPointSet<T>& points = data.points;
+    const int dim = points.dim;
+    const int num_blocks = (points.size + SEED_BLOCK - 1) / SEED_BLOCK;
+    const double expected = options.oversampling * centroids.size;
+    std::vector<double> min_distance(points.size, DBL_MAX);
+    std::vector<double> block_sums(num_blocks);
+    std::vector<std::vector<int>> block_picks(num_blocks);
+
+    // Coordinates of all the candidates, one row per candidate
+    std::vector<double> candidates;
+    std::vector<int> picks;
+    BasicPointSet<T> chosen;
+
+    long first_pick = std::min((long)(random_uniform(options.seed, 0, 0) * data.total), data.total - 1);
+    if (first_pick >= data.first && first_pick < data.first + points.size) {
+        picks.push_back(first_pick - data.first);
+    }
+    gather_candidates(points, picks, candidates, comm);
+    rows_to_points(candidates.data(), 1, dim, chosen);
+    update_min_distance(points, nullptr, chosen, 0, 1, min_distance.data(), block_sums.data());
+    free_points(chosen);
+
+    for (int round = 1; round <= options.rounds; round++) {
+        double cost = 0.0;
+        for (int b = 0; b < num_blocks; b++) {
+            cost += block_sums[b];
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &cost, 1, MPI_DOUBLE, MPI_SUM, comm);
+        if (cost <= 0.0) break;
+
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < num_blocks; b++) {
+            block_picks[b].clear();
+            int end = std::min((b + 1) * SEED_BLOCK, points.size);
+            for (int i = b * SEED_BLOCK; i < end; i++) {
+                if (random_uniform(options.seed, round, data.first + i) < expected * min_distance[i] / cost) {
+                    block_picks[b].push_back(i);
+                }
+            }
+        }
+
+        picks.clear();
+        for (int b = 0; b < num_blocks; b++) {
+            picks.insert(picks.end(), block_picks[b].begin(), block_picks[b].end());
+        }
+        int added = gather_candidates(points, picks, candidates, comm);
+        if (added == 0) continue;
+
+        rows_to_points(candidates.data() + candidates.size() - (std::size_t)added * dim, added, dim, chosen);
+        update_min_distance(points, nullptr, chosen, 0, chosen.size, min_distance.data(), block_sums.data());
+        free_points(chosen);
+    }
+
+    // Weight every candidate by the number of points of all the ranks that are closest to it
+    const int num_candidates = candidates.size() / dim;
+    BasicPointSet<T> candidate_points;
+    rows_to_points(candidates.data(), num_candidates, dim, candidate_points);
+
+    std::vector<double> weights(num_candidates, 0.0);
+    std::vector<int> labels(points.size);
+    #pragma omp parallel
+    {
+        std::vector<double> local_weights(num_candidates, 0.0);
+
+        #pragma omp for schedule(static)
+        for (int b = 0; b < num_blocks; b++) {
+            int begin = b * SEED_BLOCK;
+            int end = std::min(begin + SEED_BLOCK, points.size);
+            assign_points(points, candidate_points, begin, end, labels.data());
+            for (int i = begin; i < end; i++) {
+                local_weights[labels[i]] += 1.0;
+            }
+        }
+
+        #pragma omp critical
+        for (int c = 0; c < num_candidates; c++) {
+            weights[c] += local_weights[c];
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, weights.data(), num_candidates, MPI_DOUBLE, MPI_SUM, comm);
+
+    kmeans_plus_plus(candidate_points, weights.data(), centroids, options.seed, options.rounds + 1);
+    free_points(candidate_points);
+}
+
+/**
+ * Appends the points picked by every rank to the candidates of all the ranks, in rank order
+ *
+ * @param points points of this rank
+ * @param picks local indices of the points picked by this rank
+ * @param candidates rows of coordinates shared by all the ranks
+ * @param comm ranks taking part
+ *
+ * @return number of candidates added by all the ranks together
+ **/
+template <typename T>
+int gather_candidates(const BasicPointSet<T>& points, const std::vector<int>& picks, std::vector<double>& candidates, MPI_Comm comm) {
+    int ranks;
+    MPI_Comm_size(comm, &ranks);
+    const int dim = points.dim;
+
+    std::vector<double> local((std::size_t)picks.size() * dim);
+    for (std::size_t p = 0; p < picks.size(); p++) {
+        for (int j = 0; j < dim; j++) {
+            local[p * dim + j] = points.column(j)[picks[p]];
+        }
+    }
+
+    int local_values = local.size();
+    std::vector<int> values(ranks);
+    std::vector<int> displs(ranks, 0);
+    MPI_Allgather(&local_values, 1, MPI_INT, values.data(), 1, MPI_INT, comm);
+    for (int r = 1; r < ranks; r++) {
+        displs[r] = displs[r - 1] + values[r - 1];
+    }
+    int total_values = displs[ranks - 1] + values[ranks - 1];
+
+    std::size_t offset = candidates.size();
+    candidates.resize(offset + total_values);
+    MPI_Allgatherv(local.data(), local_values, MPI_DOUBLE, candidates.data() + offset, values.data(), displs.data(), MPI_DOUBLE, comm);
+    return dim > 0 ? total_values / dim : 0;
+}
+
+/**
+ * Builds a point set from rows of coordinates
+ *
+ * @param rows coordinates, one row of dim values per point
+ * @param count number of points
+ * @param dim dimension of each point
+ * @param points point set to allocate and fill
+ **/
+template <typename T>
+void rows_to_points(const double* rows, const int count, const int dim, BasicPointSet<T>& points) {
+    alloc_points(points, count, dim);
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < dim; j++) {
+            points.column(j)[i] = rows[(std::size_t)i * dim + j];
+        }
+    }
+}
+
+/**
+ * Writes the results of the k-means algorithm into a single csv file. Every rank formats its rows
+ * in parallel and writes them with pwrite at its own offset, found with an exclusive scan of the
+ * text sizes, so the ranks write concurrently and the points keep the order of the input.
+ *
+ * @param filename name of the file where the results will be stored
+ * @param data points of this rank
+ * @param cluster_assignments assigned cluster for each local point
+ * @param comm ranks taking part
+ **/
+template <typename T>
+void write_csv(const std::string& filename, const BasicPointSet<T>& data, int* cluster_assignments, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    FormattedRows rows = format_results(data, cluster_assignments);
+    unsigned long long bytes = rows.offsets.back();
+    unsigned long long offset = 0;
+    MPI_Exscan(&bytes, &offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+    if (rank == 0) offset = 0;
+
+    write_parts(filename, comm, [&](int fd) { return write_rows(fd, rows, offset); });
+}
+
+/**
+ * Writes only the assignments of every rank as int32 into a single file, in the order of the input
+ *
+ * @param filename name of the file where the assignments will be stored
+ * @param data part of the data set held by this rank
+ * @param cluster_assignments assigned cluster for each local point
+ * @param comm ranks taking part
+ **/
+template <typename T>
+void write_assignments(const std::string& filename, const DistributedPointSet<T>& data, int* cluster_assignments, MPI_Comm comm) {
+    write_parts(filename, comm, [&](int fd) {
+        return write_at(fd, reinterpret_cast<const char*>(cluster_assignments), data.points.size * sizeof(int), data.first * sizeof(int));
+    });
+}
+
+/**
+ * Lets every rank write its part of a shared file: rank 0 creates (or truncates) the file before
+ * the others open it, and a failure on any rank is reported once
+ *
+ * @param filename name of the file
+ * @param comm ranks taking part
+ * @param write writes the part of this rank, bool write(int fd)
+ **/
+template <typename Write>
+void write_parts(const std::string& filename, MPI_Comm comm, Write write) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    int fd = -1;
+    if (rank == 0) fd = open_results(filename, true);
+    MPI_Barrier(comm);
+    if (rank != 0) fd = open_results(filename, false);
+
+    int failed = fd < 0 || !write(fd) ? 1 : 0;
+    if (fd >= 0) close(fd);
+    int failures = 0;
+    MPI_Reduce(&failed, &failures, 1, MPI_INT, MPI_SUM, 0, comm);
+    if (rank == 0 && failures > 0) {
+        std::cerr << "Error: " << failures << " ranks could not write " << filename << std::endl;
+    }
+}
@@ -1,260 +1,187 @@
 #include <iostream>
-#include <cmath>
-#include <cfloat>
-#include <random>
 #include <fstream>
-#include <sstream>
 #include <string>
 #include <chrono>
 #include <vector>
+#include <algorithm>
 #include <omp.h>
-
-void read_csv(const std::string& filename, double**& data, int& data_size);
-void write_csv(const std::string& filename, double** data, int* cluster_assignments, int data_size);
-void k_means(const int num_centroids, double** data, int* cluster_assignments, const int data_size, const int dim);
-void init_centroids(double** centroids, const int num_centroids, const int dim);
-bool same_centroids(double** past, double** present, const int num_centroid, const int dim);
-
-int main() {
-
-    std::vector<std::string> num_puntos = {"100000", "200000", "300000", "400000", "600000", "800000", "1000000"};
-    int num_cores_virt = omp_get_max_threads();
-    int hilos[] = {1, num_cores_virt/2, num_cores_virt, 2*num_cores_virt};
-
-    double** data;
-    int data_size = 0;
-
-    std::cout << "Parallelized K-Means \n";
-    int num_iter = 10;
-
-    for (std::string points : num_puntos) {
-
-        std::string input_filename = "./inputFiles/" + points + "_data.csv";
-        std::string output_filename = points + "_results.csv";
-        float total = 0.0f;
-
-        read_csv(input_filename, data, data_size);
-
-        int* cluster_assignments = new int[data_size];
-        for (int i = 0; i < data_size; i++) {
-            cluster_assignments[i] = -1;
-        }
-
-        for (int j = 0; j < sizeof(hilos) / sizeof(hilos[0]); j++) {
-            omp_set_num_threads(hilos[j]);
-
-            for (int i = 0; i < num_iter; i++) {
-
-                double start_time = omp_get_wtime();
-                k_means(5, data, cluster_assignments, data_size, 2);
-                double end_time = omp_get_wtime(); 
-                double duration = end_time - start_time;
-                total += duration;
-
-            }
-
-            total = total / (float)num_iter;
-            std::cout << "- " << points << " points" << "(" << hilos[j] << " threads): " << total << "\n";
-        }
-
-        write_csv(output_filename, data, cluster_assignments, data_size);
-        delete[] cluster_assignments;
-
-        for (int j = 0; j < data_size; j++) {
-            delete[] data[j];
-        }
-        data_size = 0;
-
-    }
-
-    delete[] data;
-    return 0;
-}
+#include "point_set.hpp"
+#include "numa.hpp"
+#include "k_means_model.hpp"
+#include "mini_batch.hpp"
+#include "csv_io.hpp"
+#include "binary_points.hpp"
+#include "result_writer.hpp"
+#include "benchmark.hpp"
+
+template <typename T> int benchmark(const BenchmarkOptions& options);
+template <typename T> int mini_batch(const BenchmarkOptions& options);
 
 /**
- * Given a data matrix, assigns clusters to each points using the k-means algorithm
- *
- * @param num_centroids used centroids in the algorithm
- * @param data provided points for the algorithm
- * @param cluster_assigments memory where the respective cluster of each point will be stored
- * @param data_size total of points
- * @param dim dimension of the data provided
+ * Benchmarks the parallel k-means on the input files or on generated data; see print_benchmark_usage()
  **/
-void k_means(const int num_centroids, double** data, int* cluster_assignments, const int data_size, const int dim = 2) {
-    double** centroids = new double*[num_centroids];
-    double** last_centroids = new double*[num_centroids];
-
-    #pragma omp parallel for
-    for (int i = 0; i < num_centroids; i++) {
-        centroids[i] = new double[dim];
-        last_centroids[i] = new double[dim];
-    }
+int main(int argc, char* argv[]) {
 
-    #pragma omp parallel for collapse(2)
-    for (int i = 0; i < num_centroids; i++) {
-        for (int j = 0; j < dim; j++) {
-            last_centroids[i][j] = -1;
-        }
+    BenchmarkOptions options;
+    if (!parse_benchmark_args(argc, argv, options)) {
+        return -1;
     }
-
-    //Centroids initialization
-    init_centroids(centroids, num_centroids, dim);
-
-    //Update and assignment of centroids
-    int vueltas = 0;
-    while (same_centroids(last_centroids, centroids, num_centroids, dim) == false) {
-
-        // Assign value to centroid
-        #pragma omp parallel for
-        for (int i = 0; i < data_size; i++) {
-            double minDistance = DBL_MAX;
-
-            for (int num_c = 0; num_c < num_centroids; num_c++) {
-                double distance = 0;
-
-                for (int j = 0; j < dim; j++) {
-                    distance += std::pow(data[i][j] - centroids[num_c][j], 2);
-                }
-                distance = std::sqrt(distance);
-
-                if (distance < minDistance) {
-                    minDistance = distance;
-                    cluster_assignments[i] = num_c;
-                }
-            }      
-        }
-
-        #pragma omp parallel for collapse(2)
-        for (int i = 0; i < num_centroids; i++) {
-            for (int j = 0; j < dim; j++) {
-                last_centroids[i][j] = centroids[i][j];
-            }
-        }
-
-        #pragma omp parallel for
-        for (int cen = 0; cen < num_centroids; cen++) {
-            double sum[dim] = {0.0};
-            int count = 0;
-
-            for (int point = 0; point < data_size; point++) {
-                if (cluster_assignments[point] == cen) {
-                    count++;
-                    for (int j = 0; j < dim; j++)
-                        sum[j] += data[point][j];
-                }
-            }
-
-            for (int i = 0; i < dim; i++) {
-                if (count != 0) {
-                    centroids[cen][i] = sum[i] / count;
-                }
-            }
-        }
-        
-        vueltas++;
+    setup_places(options.places, options.bind, argv);
+    if (options.engine != "brute_force" && options.engine != "hamerly" && options.engine != "kd_tree" && options.engine != "gemm") {
+        std::cerr << "Error: unknown engine " << options.engine << std::endl;
+        return -1;
     }
-    //std::cout << "Num. vueltas: " << vueltas << "\n\n";
 
-    #pragma omp parallel for
-    for (int i = 0; i < num_centroids; i++) {
-        delete[] centroids[i];
-        delete[] last_centroids[i];
+    if (options.batch_size > 0) {
+        return options.float32 ? mini_batch<float>(options) : mini_batch<double>(options);
     }
-    delete[] centroids;
-    delete[] last_centroids;
-
+    return options.float32 ? benchmark<float>(options) : benchmark<double>(options);
 }
 
 /**
- * Reads the points from a given csv and stores them into memory. It also counts the number of points provided
+ * Runs the benchmark sweep with coordinates of type T
+ *
+ * @tparam T type of the coordinates; binary inputs must have been converted with the same type
+ * @param options benchmark settings
  *
- * @param filename name of the file with the points
- * @param data memory where the points will be stored
- * @param data_size total points in the file
+ * @return 0 on success
  **/
-void read_csv(const std::string& filename, double**& data, int& data_size) {
-    std::ifstream file(filename);
-    std::string line;
-
-    // First pass: count lines
-    while (std::getline(file, line)) {
-        data_size++;
-    }
-    file.clear();
-    file.seekg(0, std::ios::beg);
-    
-    // Allocate memory
-    data = new double*[data_size];
-    for(int i = 0; i < data_size; ++i) {
-        data[i] = new double[2]; // Assuming 2D points
-    }
-
-    // Second pass: read data
-    int index = 0;
-    while (std::getline(file, line)) {
-        std::stringstream ss(line);
-        std::string cell;
-        std::getline(ss, cell, ',');
-        data[index][0] = std::stod(cell);
-        std::getline(ss, cell, ',');
-        data[index][1] = std::stod(cell);
-        index++;
+template <typename T>
+int benchmark(const BenchmarkOptions& options) {
+    KMeansOptions kmeans;
+    kmeans.engine = options.engine == "hamerly" ? AssignEngine::HAMERLY
+                  : options.engine == "kd_tree" ? AssignEngine::KD_TREE
+                  : options.engine == "gemm" ? AssignEngine::GEMM : AssignEngine::BRUTE_FORCE;
+    kmeans.seeding.seed = options.seed;
+    kmeans.n_init = options.n_init;
+    kmeans.block_bounds = options.order != PointOrder::FILE;
+    kmeans.replicate_centroids = options.replicate_centroids;
+    kmeans.telemetry = !options.telemetry.empty();
+    kmeans.hardware_counters = options.hardware_counters;
+    kmeans.check_kd_tree = options.check_kd_tree;
+
+    auto load = [](const std::string& filename, BasicPointSet<T>& data) {
+        if (is_binary_points(filename)) {
+            return map_binary_points(filename, data);
+        }
+        return load_csv(filename, data);
+    };
+    // One model for every data set and thread count, so its buffers are reused between runs
+    KMeans<T> model(options.clusters, kmeans);
+    auto run = [&](const BasicPointSet<T>& data, int* cluster_assignments) {
+        return model.fit_predict(data, cluster_assignments);
+    };
+    auto write = [](const std::string& filename, const BasicPointSet<T>& data, int* cluster_assignments) {
+        write_csv(filename, data, cluster_assignments);
+    };
+
+    if (options.sweep > 0) {
+        auto start = [&](const BasicPointSet<T>& data, int* cluster_assignments, const int k) {
+            model.set_num_centroids(k);
+            return model.fit_predict(data, cluster_assignments);
+        };
+        auto grow = [&](const BasicPointSet<T>& data, int* cluster_assignments) {
+            return model.grow(data, cluster_assignments);
+        };
+        return run_sweep<T>("k_means_par", options, load, start, grow, write);
     }
+    return run_benchmark<T>("k_means_par", options, load, run, write);
 }
 
 /**
- * Writes the results of the k-means algorithm into a csv file
+ * Streams every input file through the mini-batch k-means once per thread count. The assignments of
+ * the final pass are written batch by batch at their offset of the results file, so no step holds
+ * more than two batches of points in memory.
+ *
+ * @tparam T type of the coordinates; binary inputs must have been converted with the same type
+ * @param options benchmark settings
  *
- * @param filename name of the file where the results will be stored
- * @param data points used during the algorithm
- * @param cluster_assignments assigned cluster for each value
- * @param data_size number of points used
+ * @return 0 on success
  **/
-void write_csv(const std::string& filename, double** data, int* cluster_assignments, int data_size) {
-    std::ofstream file(filename);
-    for (int i = 0; i < data_size; ++i) {
-        file << data[i][0] << "," << data[i][1] << "," << cluster_assignments[i] << "\n";
+template <typename T>
+int mini_batch(const BenchmarkOptions& options) {
+    const bool machine_output = options.format != BenchmarkFormat::TEXT;
+    std::ostream& log = machine_output && options.output.empty() ? std::cerr : std::cout;
+    std::vector<BenchmarkRecord> records;
+    log << "k_means_par (" << (sizeof(T) == sizeof(float) ? "float32" : "float64") << ", mini-batch of "
+        << options.batch_size << " points)\n";
+    if (!options.synthetic.empty()) {
+        std::cerr << "Warning: generated data sets are not streamed, only --input files" << std::endl;
+    }
+    if (options.order != PointOrder::FILE) {
+        std::cerr << "Warning: streamed points are clustered in file order" << std::endl;
     }
-}
 
-/**
- * Generate random values for the specified centroids and dimensions
- *
- * @param centroids memory where the centroids will be allocated
- * @param num_centroids used centroids in the algorithm
- * @param dim dimension of the data provided
- **/
-void init_centroids(double** centroids, const int num_centroids, const int dim = 2) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<double> dis(0.0, 1.0);
+    MiniBatchOptions mini;
+    mini.batch_size = options.batch_size;
+    mini.max_epochs = std::max(options.epochs, 1);
+    mini.seeding.seed = options.seed;
 
-    #pragma omp parallel for collapse(2)
-    for (int i = 0; i < num_centroids; i++) {
-        for (int j = 0; j < dim; j++) {
-            double num = dis(gen);
-            centroids[i][j] = num;
+    for (const std::string& input_filename : options.inputs) {
+        // A binary copy made with csv_to_bin is read instead of parsing the csv
+        std::string filename = binary_sibling(input_filename);
+        if (access(filename.c_str(), R_OK) != 0) {
+            filename = input_filename;
         }
-    }
-}
+        PointStream<T> stream;
+        if (!stream_open(filename, stream)) {
+            continue;
+        }
+        const std::string name = dataset_name(input_filename);
+
+        for (int threads : options.threads) {
+            omp_set_num_threads(threads);
+            BenchmarkRecord record;
+            record.program = "k_means_par";
+            record.precision = sizeof(T) == sizeof(float) ? "float32" : "float64";
+            record.engine = "mini_batch";
+            record.dataset = name;
+            record.affinity = pin_threads(options.pin);
+            record.numa = numa_policy(false);
+            record.dim = stream.dim;
+            record.clusters = options.clusters;
+            record.threads = threads;
+            record.repetitions = 1;
+
+            const std::string results_filename = name + (options.binary_results ? "_assignments.bin" : "_results.csv");
+            int fd = options.write_results ? open_results(results_filename, true) : -1;
+            off_t offset = 0;
+            bool written = true;
+            auto sink = [&](const BasicPointSet<T>& batch, const int* labels, const std::uint64_t first) {
+                if (fd < 0) return;
+                if (options.binary_results) {
+                    written &= write_at(fd, reinterpret_cast<const char*>(labels), batch.size * sizeof(int), first * sizeof(int));
+                }
+                else {
+                    FormattedRows rows = format_results(batch, labels);
+                    written &= write_rows(fd, rows, offset);
+                    offset += rows.offsets.back();
+                }
+            };
+
+            BasicPointSet<T> centroids;
+            std::vector<double> seconds = time_runs(0, 1, [&] {
+                record.result = mini_batch_k_means(stream, options.clusters, centroids, mini, sink);
+            });
+            record.time = summarize_times(seconds);
+            record.points = stream.next;
+            free_points(centroids);
+            if (fd >= 0) {
+                close(fd);
+                if (!written) {
+                    std::cerr << "Error: could not write " << results_filename << std::endl;
+                }
+            }
 
-/**
- * Function that check if any of the values of the centroids was updated.
- *
- * @param past previous array of centroids
- * @param present current array of centroids
- * @param num_centroid used centroids in the algorithm
- * @param dim dimension of the data provided
- *
- * @return Returns true if nothing changed.
- **/
-bool same_centroids(double** past, double** present, int num_centroid, int dim) {
-    
-    for (int i = 0; i < num_centroid; i++) {
-        for (int j = 0; j < dim; j++) {
-            if (past[i][j] != present[i][j]) return false;
+            write_record_text(log, record);
+            records.push_back(record);
+        }
+
+        if (stream.errors > 0) {
+            std::cerr << "Warning: skipped " << stream.errors << " lines that are not points in " << filename << std::endl;
         }
+        stream_close(stream);
     }
 
-    return true;
+    return write_benchmark_output(options, records);
 }
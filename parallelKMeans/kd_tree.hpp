@@ -0,0 +1,468 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <limits>
+#include <numeric>
+#include <vector>
+#include "point_set.hpp"
+#include "distance_kernels.hpp"
+#include "hamerly.hpp"
+
+// Largest number of points kept in a leaf of the k-d tree
+constexpr int KD_LEAF_SIZE = 32;
+// Subtrees with more points than this are built by their own task
+constexpr int KD_TASK_POINTS = 1 << 14;
+
+/**
+ * k-d tree over the points for the filtering assignment (Kanungo et al.). Nodes are stored in heap
+ * order (the children of node n are 2n + 1 and 2n + 2) and split at the median of the widest side
+ * of their box, so the tree is balanced and every leaf has at most KD_LEAF_SIZE points. The points
+ * are copied in tree order, so every node covers a contiguous range of them.
+ *
+ * points: copy of the points in tree order
+ * index: original index of every point in tree order
+ * begin, end: range of points of every node
+ * lower, upper: bounding box of every node, coordinate j of node n at n * dim + j
+ * sums: coordinate sums of the points of every node, kept in double like the cluster sums
+ * scatter: sum of the squared distances from the points of every node to their mean
+ * depth: level of the deepest leaves
+ **/
+template <typename T>
+struct KdTree {
+    BasicPointSet<T> points;
+    std::vector<int> index;
+    std::vector<int> begin;
+    std::vector<int> end;
+    std::vector<T> lower;
+    std::vector<T> upper;
+    std::vector<double> sums;
+    std::vector<double> scatter;
+    int depth = 0;
+};
+
+/**
+ * State of the filtering assignment kept between iterations of a run
+ *
+ * owner: cluster of all the points of a node after the last iteration, -1 if they are not all known
+ *        to share one; a subtree whose owner does not change costs nothing to relabel
+ * labels: cluster of every point in tree order
+ * candidates: per-thread stack of candidate lists, one list of up to k centroids per level
+ **/
+struct KdFilterState {
+    std::vector<int> owner;
+    std::vector<int> labels;
+    std::vector<int> candidates;
+};
+
+/**
+ * Computes the box of a node and splits it, the halves as tasks when they are large
+ *
+ * @param tree tree being built, with the index of the points
+ * @param data points in their original order
+ * @param node node to build
+ * @param begin first point of the node
+ * @param end one past the last point of the node
+ **/
+template <typename T>
+inline void kd_build_node(KdTree<T>& tree, const BasicPointSet<T>& data, const int node, const int begin, const int end) {
+    const int dim = data.dim;
+    tree.begin[node] = begin;
+    tree.end[node] = end;
+
+    T* lower = tree.lower.data() + (std::size_t)node * dim;
+    T* upper = tree.upper.data() + (std::size_t)node * dim;
+    int split = 0;
+    for (int j = 0; j < dim; j++) {
+        const T* x = data.column(j);
+        T low = std::numeric_limits<T>::max();
+        T high = std::numeric_limits<T>::lowest();
+        for (int i = begin; i < end; i++) {
+            low = std::min(low, x[tree.index[i]]);
+            high = std::max(high, x[tree.index[i]]);
+        }
+        lower[j] = low;
+        upper[j] = high;
+        if (high - low > upper[split] - lower[split]) split = j;
+    }
+    if (end - begin <= KD_LEAF_SIZE) return;
+
+    // Median of the widest side; equal coordinates are ordered by index so the tree is deterministic
+    const int mid = begin + (end - begin) / 2;
+    const T* x = data.column(split);
+    std::nth_element(tree.index.begin() + begin, tree.index.begin() + mid, tree.index.begin() + end,
+                     [x](const int a, const int b) { return x[a] < x[b] || (x[a] == x[b] && a < b); });
+
+    // References would be firstprivate in the tasks, which copies the tree
+    #pragma omp task shared(tree, data) if(mid - begin > KD_TASK_POINTS)
+    kd_build_node(tree, data, 2 * node + 1, begin, mid);
+    #pragma omp task shared(tree, data) if(end - mid > KD_TASK_POINTS)
+    kd_build_node(tree, data, 2 * node + 2, mid, end);
+}
+
+/**
+ * Builds the k-d tree of a point set: the nodes are split with parallel tasks, the points are
+ * copied in tree order and the node sums and scatters are added up level by level from the leaves
+ *
+ * @param tree tree to build; its buffers are reused
+ * @param data points to index
+ **/
+template <typename T>
+inline void kd_build(KdTree<T>& tree, const BasicPointSet<T>& data) {
+    const int n = data.size;
+    const int dim = data.dim;
+    tree.depth = 0;
+    for (int count = n; count > KD_LEAF_SIZE; count = (count + 1) / 2) {
+        tree.depth++;
+    }
+    const int num_nodes = (2 << tree.depth) - 1;
+
+    tree.index.resize(n);
+    std::iota(tree.index.begin(), tree.index.end(), 0);
+    tree.begin.assign(num_nodes, 0);
+    tree.end.assign(num_nodes, 0);
+    tree.lower.resize((std::size_t)num_nodes * dim);
+    tree.upper.resize((std::size_t)num_nodes * dim);
+    tree.sums.assign((std::size_t)num_nodes * dim, 0.0);
+    tree.scatter.assign(num_nodes, 0.0);
+
+    #pragma omp parallel
+    #pragma omp single
+    kd_build_node(tree, data, 0, 0, n);
+
+    if (!tree.points.coords || tree.points.size != n || tree.points.dim != dim) {
+        free_points(tree.points);
+        alloc_points(tree.points, n, dim);
+    }
+    for (int j = 0; j < dim; j++) {
+        const T* x = data.column(j);
+        T* y = tree.points.column(j);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            y[i] = x[tree.index[i]];
+        }
+    }
+
+    for (int level = tree.depth; level >= 0; level--) {
+        const int first = (1 << level) - 1;
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (int node = first; node < 2 * first + 1; node++) {
+            double* sum = tree.sums.data() + (std::size_t)node * dim;
+            const int count = tree.end[node] - tree.begin[node];
+            if (count == 0) continue;
+            if (count <= KD_LEAF_SIZE) {
+                for (int j = 0; j < dim; j++) {
+                    const T* x = tree.points.column(j);
+                    for (int i = tree.begin[node]; i < tree.end[node]; i++) sum[j] += x[i];
+                    const double mean = sum[j] / count;
+                    for (int i = tree.begin[node]; i < tree.end[node]; i++) {
+                        tree.scatter[node] += (x[i] - mean) * (x[i] - mean);
+                    }
+                }
+            }
+            else {
+                // The scatters of the halves are combined around their means, which never cancels
+                const int left_node = 2 * node + 1;
+                const int right_node = 2 * node + 2;
+                const double left_count = tree.end[left_node] - tree.begin[left_node];
+                const double right_count = tree.end[right_node] - tree.begin[right_node];
+                const double* left = tree.sums.data() + (std::size_t)left_node * dim;
+                const double* right = tree.sums.data() + (std::size_t)right_node * dim;
+                double between = 0.0;
+                for (int j = 0; j < dim; j++) {
+                    sum[j] = left[j] + right[j];
+                    const double diff = left[j] / left_count - right[j] / right_count;
+                    between += diff * diff;
+                }
+                tree.scatter[node] = tree.scatter[left_node] + tree.scatter[right_node] + left_count * right_count / count * between;
+            }
+        }
+    }
+}
+
+/**
+ * Releases the memory of a tree
+ **/
+template <typename T>
+inline void kd_free(KdTree<T>& tree) {
+    free_points(tree.points);
+    tree = KdTree<T>();
+}
+
+/**
+ * Prepares the filtering state for a new run: no point has a cluster yet
+ *
+ * @param state state to prepare
+ * @param tree tree of the data set
+ * @param num_centroids used centroids in the algorithm
+ * @param num_threads threads of the team that runs the algorithm
+ **/
+template <typename T>
+inline void kd_filter_init(KdFilterState& state, const KdTree<T>& tree, const int num_centroids, const int num_threads) {
+    state.owner.assign(tree.begin.size(), -1);
+    state.labels.assign(tree.index.size(), -1);
+    state.candidates.resize((std::size_t)num_threads * num_centroids * (tree.depth + 2));
+}
+
+/**
+ * Whether every point of a box is closer to centroid best than to centroid c. Only the corner of
+ * the box furthest in the direction from best to c has to be checked. The difference must exceed
+ * the relative margin of hamerly_slack(), so rounding never discards a centroid that the
+ * brute-force assignment would choose.
+ **/
+template <typename T>
+inline bool kd_dominated(const T* lower, const T* upper, const BasicPointSet<T>& centroids, const int c, const int best) {
+    double to_c = 0.0;
+    double to_best = 0.0;
+    for (int j = 0; j < centroids.dim; j++) {
+        double zc = centroids.column(j)[c];
+        double zb = centroids.column(j)[best];
+        double corner = zc > zb ? upper[j] : lower[j];
+        to_c += (corner - zc) * (corner - zc);
+        to_best += (corner - zb) * (corner - zb);
+    }
+    return to_c - to_best > hamerly_slack<T>() * (to_c + to_best);
+}
+
+/**
+ * Brute-force assignment of a block of points pruned with the bounding box of the block, the same
+ * test the filtering applies to a node of the tree. The centroids dominated over the whole box by
+ * the one closest to its center are skipped; if only that one is left the block is labelled without
+ * computing any distance. Pays off when the points are stored in spatial order (see point_order.hpp),
+ * so that a block covers a small region; otherwise few centroids are pruned and it costs one pass.
+ * The assignments are the same as the ones of assign_points().
+ *
+ * @param points point set
+ * @param centroids current centroids
+ * @param begin first point to assign
+ * @param end one past the last point to assign
+ * @param cluster_assignments memory where the closest centroid of each point is stored
+ *
+ * @return number of points whose cluster changed
+ **/
+template <typename T>
+inline int assign_block_bounded(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int begin, const int end, int* cluster_assignments) {
+    const int dim = points.dim;
+    thread_local std::vector<T> box;
+    thread_local std::vector<int> candidates;
+    box.resize(2 * (std::size_t)dim);
+    candidates.resize(centroids.size);
+    T* lower = box.data();
+    T* upper = box.data() + dim;
+    for (int j = 0; j < dim; j++) {
+        const T* x = points.column(j);
+        T low = x[begin];
+        T high = x[begin];
+        for (int i = begin + 1; i < end; i++) {
+            low = std::min(low, x[i]);
+            high = std::max(high, x[i]);
+        }
+        lower[j] = low;
+        upper[j] = high;
+    }
+
+    int best = 0;
+    double best_distance = DBL_MAX;
+    for (int c = 0; c < centroids.size; c++) {
+        double distance = 0.0;
+        for (int j = 0; j < dim; j++) {
+            double diff = 0.5 * ((double)lower[j] + upper[j]) - centroids.column(j)[c];
+            distance += diff * diff;
+        }
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = c;
+        }
+    }
+    int num_candidates = 0;
+    for (int c = 0; c < centroids.size; c++) {
+        if (c == best || !kd_dominated(lower, upper, centroids, c, best)) {
+            candidates[num_candidates++] = c;
+        }
+    }
+
+    if (num_candidates == 1) {
+        int changed = 0;
+        for (int i = begin; i < end; i++) {
+            changed += cluster_assignments[i] != best;
+            cluster_assignments[i] = best;
+        }
+        return changed;
+    }
+    if (num_candidates == centroids.size) {
+        return assign_points(points, centroids, begin, end, cluster_assignments);
+    }
+    return assign_points_among(points, centroids, candidates.data(), num_candidates, begin, end, cluster_assignments);
+}
+
+/**
+ * Filtering assignment of a subtree. The candidate centroids closer to the center of the node than
+ * every other candidate prune the ones that cannot be the closest to any point of the node; when a
+ * single candidate is left the whole subtree goes to it and its cached sums are added at once, and
+ * its squared distances follow from its scatter and the distance from its mean to the centroid.
+ * Leaves evaluate the remaining candidates for each point, lowest index first, so ties are resolved
+ * like in assign_points().
+ *
+ * @param tree tree of the data set
+ * @param state labels and owners of the run
+ * @param centroids current centroids
+ * @param node node to assign
+ * @param candidates current candidate list; the lists of the children are written after it
+ * @param num_candidates length of the list
+ * @param inherited cluster that all the points of the node had if the parent knew it, else -1
+ * @param sums per-cluster coordinate sums of the thread
+ * @param counts per-cluster number of points of the thread
+ * @param distances per-cluster sums of squared distances of the thread
+ *
+ * @return number of points whose cluster changed
+ **/
+template <typename T>
+inline long kd_filter(const KdTree<T>& tree, KdFilterState& state, const BasicPointSet<T>& centroids, const int node,
+                      int* candidates, int num_candidates, const int inherited, double* sums, long* counts, double* distances) {
+    const int dim = centroids.dim;
+    const int num_centroids = centroids.size;
+    const int begin = tree.begin[node];
+    const int end = tree.end[node];
+    const T* lower = tree.lower.data() + (std::size_t)node * dim;
+    const T* upper = tree.upper.data() + (std::size_t)node * dim;
+    int* labels = state.labels.data();
+    if (inherited >= 0) state.owner[node] = inherited;
+
+    if (num_candidates > 1) {
+        int best = candidates[0];
+        double best_distance = DBL_MAX;
+        for (int k = 0; k < num_candidates; k++) {
+            double distance = 0.0;
+            for (int j = 0; j < dim; j++) {
+                double diff = 0.5 * ((double)lower[j] + upper[j]) - centroids.column(j)[candidates[k]];
+                distance += diff * diff;
+            }
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = candidates[k];
+            }
+        }
+
+        int* kept = candidates + num_centroids;
+        int num_kept = 0;
+        for (int k = 0; k < num_candidates; k++) {
+            if (candidates[k] == best || !kd_dominated(lower, upper, centroids, candidates[k], best)) {
+                kept[num_kept++] = candidates[k];
+            }
+        }
+        candidates = kept;
+        num_candidates = num_kept;
+    }
+
+    long changed = 0;
+    if (num_candidates == 1) {
+        const int c = candidates[0];
+        int& owner = state.owner[node];
+        if (owner != c) {
+            if (owner >= 0) {
+                changed = end - begin;
+                std::fill(labels + begin, labels + end, c);
+            }
+            else {
+                for (int i = begin; i < end; i++) {
+                    changed += labels[i] != c;
+                    labels[i] = c;
+                }
+            }
+            owner = c;
+        }
+        counts[c] += end - begin;
+        const double* node_sums = tree.sums.data() + (std::size_t)node * dim;
+        if (end == begin) return changed;
+        double offset = 0.0;
+        for (int j = 0; j < dim; j++) {
+            sums[(std::size_t)j * num_centroids + c] += node_sums[j];
+            const double diff = node_sums[j] / (end - begin) - centroids.column(j)[c];
+            offset += diff * diff;
+        }
+        distances[c] += tree.scatter[node] + (end - begin) * offset;
+        return changed;
+    }
+
+    if (end - begin <= KD_LEAF_SIZE) {
+        state.owner[node] = -1;
+        for (int i = begin; i < end; i++) {
+            int closest = candidates[0];
+            T closest_distance = squared_distance(tree.points, i, centroids, closest);
+            for (int k = 1; k < num_candidates; k++) {
+                T distance = squared_distance(tree.points, i, centroids, candidates[k]);
+                if (distance < closest_distance) {
+                    closest_distance = distance;
+                    closest = candidates[k];
+                }
+            }
+            changed += labels[i] != closest;
+            labels[i] = closest;
+            counts[closest]++;
+            distances[closest] += closest_distance;
+            for (int j = 0; j < dim; j++) {
+                sums[(std::size_t)j * num_centroids + closest] += tree.points.column(j)[i];
+            }
+        }
+        return changed;
+    }
+
+    const int owner = state.owner[node];
+    state.owner[node] = -1;
+    changed += kd_filter(tree, state, centroids, 2 * node + 1, candidates, num_candidates, owner, sums, counts, distances);
+    changed += kd_filter(tree, state, centroids, 2 * node + 2, candidates, num_candidates, owner, sums, counts, distances);
+    return changed;
+}
+
+/**
+ * Debugging check of the filtering: relabels the points in tree positions [begin, end) by brute
+ * force with assign_points() and compares the result with the labels of the tree. A label only
+ * counts as wrong when its centroid is farther than the brute-force one by more than the rounding
+ * of the distances, since ties may be resolved either way.
+ *
+ * @param tree tree of the data set
+ * @param state labels of the run after kd_filter() covered the whole tree
+ * @param centroids centroids the points were labelled with
+ * @param begin first tree position to check, a multiple of ASSIGN_BLOCK
+ * @param end one past the last tree position to check
+ *
+ * @return number of points with a wrong label
+ **/
+template <typename T>
+inline int kd_check_labels(const KdTree<T>& tree, const KdFilterState& state, const BasicPointSet<T>& centroids, const int begin, const int end) {
+    // The sample is a view of the tree points, which keeps the alignment of the columns
+    BasicPointSet<T> sample = tree.points;
+    sample.coords += begin;
+    sample.size = end - begin;
+    sample.mapping = nullptr;
+    std::vector<int> labels(sample.size, -1);
+    assign_points(sample, centroids, 0, sample.size, labels.data());
+
+    int wrong = 0;
+    for (int i = 0; i < sample.size; i++) {
+        const int label = state.labels[begin + i];
+        if (label == labels[i]) continue;
+        double distance = squared_distance(sample, i, centroids, label);
+        double closest = squared_distance(sample, i, centroids, labels[i]);
+        wrong += distance > closest * (1.0 + hamerly_slack<T>());
+    }
+    return wrong;
+}
+
+/**
+ * Level of the tree whose nodes are distributed among the threads: deep enough for a few nodes per
+ * thread, and above the deepest leaves so that every node of the level exists
+ *
+ * @param tree tree of the data set
+ * @param num_threads threads of the team
+ *
+ * @return level of the nodes handed out as tasks
+ **/
+template <typename T>
+inline int kd_task_level(const KdTree<T>& tree, const int num_threads) {
+    int level = 0;
+    while (level + 1 < tree.depth && (1 << level) < 8 * num_threads) {
+        level++;
+    }
+    return level;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <omp.h>
+#include "point_set.hpp"
+#include "distance_kernels.hpp"
+#include "seeding.hpp"
+#include "convergence.hpp"
+#include "point_stream.hpp"
+#include "k_means_model.hpp"
+
+/**
+ * Settings of the mini-batch k-means
+ *
+ * batch_size: points per batch; with the batch being read in the background, two batches are all
+ *             the points kept in memory
+ * max_epochs: passes over the file before the final assignment pass
+ * shift_tolerance: stop after an epoch in which no centroid moved more than this; negative disables it
+ * seeding: how the initial centroids are chosen from the first batch (see seeding.hpp)
+ **/
+struct MiniBatchOptions {
+    int batch_size = 1 << 16;
+    int max_epochs = 5;
+    double shift_tolerance = 1e-4;
+    SeedingOptions seeding;
+};
+
+/**
+ * Mini-batch step: assigns the points of a batch and moves every centroid towards the mean of its
+ * points with a per-centroid learning rate (Sculley, 2010). A centroid that has absorbed v points
+ * so far, m of them in this batch with sum s, becomes c + (s - m c) / (v + m), i.e. every point
+ * pulls it with rate 1 / (points seen by that centroid), so the steps shrink as it settles.
+ *
+ * @param batch points of the batch
+ * @param centroids current centroids, updated in place
+ * @param seen points absorbed by every centroid so far, updated
+ * @param labels scratch memory for the cluster of every point of the batch
+ * @param partial_sums per-thread cluster sums, sums_stride values per thread
+ * @param partial_counts per-thread cluster counts, counts_stride values per thread
+ * @param sums_stride values per thread in partial_sums
+ * @param counts_stride values per thread in partial_counts
+ **/
+template <typename T>
+inline void mini_batch_step(const BasicPointSet<T>& batch, BasicPointSet<T>& centroids, std::vector<long>& seen, int* labels,
+                            double* partial_sums, long* partial_counts, const int sums_stride, const int counts_stride) {
+    const int num_centroids = centroids.size;
+    const int dim = centroids.dim;
+
+    #pragma omp parallel
+    {
+        const int team_size = omp_get_num_threads();
+        double* thread_sums = partial_sums + (std::size_t)omp_get_thread_num() * sums_stride;
+        long* thread_counts = partial_counts + (std::size_t)omp_get_thread_num() * counts_stride;
+        std::fill(thread_sums, thread_sums + sums_stride, 0.0);
+        std::fill(thread_counts, thread_counts + counts_stride, 0);
+
+        #pragma omp for schedule(static)
+        for (int begin = 0; begin < batch.size; begin += ASSIGN_BLOCK) {
+            int end = std::min(begin + ASSIGN_BLOCK, batch.size);
+            assign_and_accumulate(batch, centroids, begin, end, labels, thread_sums, thread_counts, nullptr);
+        }
+
+        #pragma omp for
+        for (int cen = 0; cen < num_centroids; cen++) {
+            long count = 0;
+            for (int t = 0; t < team_size; t++) {
+                count += partial_counts[(std::size_t)t * counts_stride + cen];
+            }
+            if (count == 0) continue;
+            seen[cen] += count;
+            for (int j = 0; j < dim; j++) {
+                double sum = 0.0;
+                for (int t = 0; t < team_size; t++) {
+                    sum += partial_sums[(std::size_t)t * sums_stride + (std::size_t)j * num_centroids + cen];
+                }
+                T& center = centroids.column(j)[cen];
+                center += (sum - count * (double)center) / seen[cen];
+            }
+        }
+    }
+}
+
+/**
+ * Mini-batch k-means over a point file that does not need to fit in memory. The file is read in
+ * batches by a background thread (see BatchReader) while the previous batch is being clustered;
+ * the first batch seeds the centroids. Every epoch is one pass over the file. After the last epoch
+ * a final pass assigns every point to its closest centroid and hands the labels of every batch to
+ * the sink, e.g. to append them to a results file.
+ *
+ * @tparam T type of the coordinates and centroids; cluster sums are always accumulated in double
+ * @param stream open point stream
+ * @param num_centroids used centroids in the algorithm
+ * @param centroids memory where the final centroids will be stored, allocated here
+ * @param options algorithm settings
+ * @param sink called with every batch of the final pass, void sink(const BasicPointSet<T>& batch, const int* labels, std::uint64_t first)
+ *
+ * @return batches processed (as iterations), stop reason, shift of the last epoch and inertia of the final assignment
+ **/
+template <typename T, typename Sink>
+inline KMeansResult mini_batch_k_means(PointStream<T>& stream, const int num_centroids, BasicPointSet<T>& centroids,
+                                       const MiniBatchOptions& options, Sink sink) {
+    const int dim = stream.dim;
+    const int num_threads = omp_get_max_threads();
+    const int sums_stride = (num_centroids * dim + PARTIAL_PADDING - 1) / PARTIAL_PADDING * PARTIAL_PADDING;
+    const int counts_stride = (num_centroids + PARTIAL_PADDING - 1) / PARTIAL_PADDING * PARTIAL_PADDING;
+    std::vector<double> partial_sums((std::size_t)num_threads * sums_stride);
+    std::vector<long> partial_counts((std::size_t)num_threads * counts_stride);
+    std::vector<long> seen(num_centroids, 0);
+    std::vector<int> labels(options.batch_size, -1);
+
+    free_points(centroids);
+    alloc_points(centroids, num_centroids, dim);
+    BasicPointSet<T> epoch_start;
+    alloc_points(epoch_start, num_centroids, dim);
+
+    KMeansResult result;
+    bool seeded = false;
+    for (int epoch = 0; epoch < options.max_epochs && result.reason == StopReason::NOT_CONVERGED; epoch++) {
+        stream_rewind(stream);
+        BatchReader<T> reader(stream, options.batch_size);
+        if (seeded) {
+            copy_points(centroids, epoch_start);
+        }
+        for (const BasicPointSet<T>* batch = reader.next(); batch; batch = reader.next()) {
+            if (!seeded) {
+                seed_centroids(*batch, centroids, options.seeding);
+                copy_points(centroids, epoch_start);
+                seeded = true;
+            }
+            mini_batch_step(*batch, centroids, seen, labels.data(), partial_sums.data(), partial_counts.data(), sums_stride, counts_stride);
+            result.iterations++;
+        }
+        if (!seeded) break;
+
+        // Largest displacement of a centroid over the whole epoch
+        result.shift = 0.0;
+        for (int cen = 0; cen < num_centroids; cen++) {
+            double distance = 0.0;
+            for (int j = 0; j < dim; j++) {
+                double diff = (double)centroids.column(j)[cen] - epoch_start.column(j)[cen];
+                distance += diff * diff;
+            }
+            result.shift = std::max(result.shift, std::sqrt(distance));
+        }
+        if (options.shift_tolerance >= 0.0 && result.shift <= options.shift_tolerance) {
+            result.reason = StopReason::CENTROID_SHIFT;
+        }
+    }
+    if (result.reason == StopReason::NOT_CONVERGED) {
+        result.reason = StopReason::MAX_ITERATIONS;
+    }
+    free_points(epoch_start);
+
+    // Final pass: closest centroid of every point and the inertia of the assignment
+    stream_rewind(stream);
+    BatchReader<T> reader(stream, options.batch_size);
+    std::uint64_t first = 0;
+    double inertia = 0.0;
+    for (const BasicPointSet<T>* batch = reader.next(); batch; batch = reader.next()) {
+        double batch_inertia = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:batch_inertia)
+        for (int begin = 0; begin < batch->size; begin += ASSIGN_BLOCK) {
+            int end = std::min(begin + ASSIGN_BLOCK, batch->size);
+            assign_points(*batch, centroids, begin, end, labels.data());
+            for (int i = begin; i < end; i++) {
+                batch_inertia += squared_distance(*batch, i, centroids, labels[i]);
+            }
+        }
+        inertia += batch_inertia;
+        sink(*batch, labels.data(), first);
+        first += batch->size;
+    }
+    result.inertia = inertia;
+    return result;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "point_set.hpp"
+
+/**
+ * Number of NUMA nodes of the machine, read from sysfs; 1 if it cannot be read
+ **/
+inline int numa_node_count() {
+    int nodes = 0;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::isdigit((unsigned char)name[4])) {
+            nodes++;
+        }
+    }
+    return std::max(nodes, 1);
+}
+
+/**
+ * NUMA node of the cpu the calling thread is running on
+ **/
+inline int current_numa_node() {
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if (getcpu(&cpu, &node) != 0) return 0;
+    return node;
+}
+
+/**
+ * Copies of the centroids, one per NUMA node. Every copy is allocated and written by a thread of
+ * its node, so the threads of a node read the centroids from local memory during the assignment.
+ *
+ * copies: centroids of every node, allocated the first time a thread of the node asks for them
+ * version: iteration each copy was last refreshed in
+ * current: iteration of the centroids being replicated
+ **/
+template <typename T>
+struct CentroidReplicas {
+    std::vector<BasicPointSet<T>> copies;
+    std::vector<long> version;
+    long current = 0;
+};
+
+/**
+ * Releases the copies of every node
+ **/
+template <typename T>
+inline void replicas_free(CentroidReplicas<T>& replicas) {
+    for (BasicPointSet<T>& copy : replicas.copies) {
+        if (copy.coords) free_points(copy);
+    }
+    replicas.copies.clear();
+    replicas.version.clear();
+}
+
+/**
+ * Prepares one copy per NUMA node for a new run; copies of a previous run are kept and refreshed
+ *
+ * @param replicas copies to prepare
+ * @param nodes number of NUMA nodes
+ **/
+template <typename T>
+inline void replicas_init(CentroidReplicas<T>& replicas, const int nodes) {
+    if ((int)replicas.copies.size() != nodes) {
+        replicas_free(replicas);
+        replicas.copies.assign(nodes, BasicPointSet<T>());
+    }
+    replicas.version.assign(nodes, -1);
+    replicas.current = 0;
+}
+
+/**
+ * Copy of the centroids for the node of the calling thread. Called by every thread of a parallel
+ * region after replicas.current was advanced; the first thread of each node refreshes its copy.
+ * Without replicas the centroids themselves are returned.
+ *
+ * @param replicas copies of every node
+ * @param centroids centroids of the current iteration
+ *
+ * @return centroids to read from
+ **/
+template <typename T>
+inline const BasicPointSet<T>& local_replica(CentroidReplicas<T>& replicas, const BasicPointSet<T>& centroids) {
+    if (replicas.copies.empty()) return centroids;
+
+    const int node = current_numa_node() % replicas.copies.size();
+    BasicPointSet<T>& copy = replicas.copies[node];
+    #pragma omp critical(centroid_replicas)
+    {
+        if (replicas.version[node] != replicas.current) {
+            if (!copy.coords || copy.size != centroids.size || copy.dim != centroids.dim) {
+                free_points(copy);
+                alloc_points(copy, centroids.size, centroids.dim);
+            }
+            std::copy(centroids.coords, centroids.coords + (std::size_t)centroids.dim * centroids.stride, copy.coords);
+            replicas.version[node] = replicas.current;
+        }
+    }
+    return copy;
+}
+
+/**
+ * Makes the OpenMP runtime bind its threads to the given places. The runtime only reads
+ * OMP_PLACES and OMP_PROC_BIND at startup, so if they differ the program restarts itself with them
+ * set; it must be called before any parallel region.
+ *
+ * @param places OMP_PLACES value (threads, cores, sockets or an explicit list), empty to keep the environment
+ * @param bind OMP_PROC_BIND value (close, spread, master)
+ * @param argv arguments of the program, passed again on restart
+ **/
+inline void setup_places(const std::string& places, const std::string& bind, char* argv[]) {
+    if (places.empty()) return;
+    const char* current_places = std::getenv("OMP_PLACES");
+    const char* current_bind = std::getenv("OMP_PROC_BIND");
+    if (current_places && current_bind && places == current_places && bind == current_bind) return;
+
+    setenv("OMP_PLACES", places.c_str(), 1);
+    setenv("OMP_PROC_BIND", bind.c_str(), 1);
+    execv("/proc/self/exe", argv);
+    std::cerr << "Warning: could not restart with OMP_PLACES=" << places << ", threads are not bound by the runtime" << std::endl;
+}
+
+/**
+ * Description of the thread and memory placement in effect, for the benchmark records
+ *
+ * @param replicas whether the centroids are replicated per NUMA node
+ *
+ * @return e.g. "first_touch;places=cores;bind=close;nodes=2;replicas"
+ **/
+inline std::string numa_policy(const bool replicas) {
+    std::string policy = "first_touch";
+#ifdef _OPENMP
+    const char* places = std::getenv("OMP_PLACES");
+    if (omp_get_proc_bind() != omp_proc_bind_false && places) {
+        policy += std::string(";places=") + places;
+        const char* bind = std::getenv("OMP_PROC_BIND");
+        if (bind) policy += std::string(";bind=") + bind;
+    }
+#endif
+    policy += ";nodes=" + std::to_string(numa_node_count());
+    if (replicas) policy += ";replicas";
+    return policy;
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "point_set.hpp"
+
+// Order in which the points are stored for the clustering
+enum class PointOrder {
+    FILE,       // as read
+    MORTON,     // along a Z-order curve
+    HILBERT     // along a Hilbert curve
+};
+
+// Bits of the curve index of every point
+constexpr int ORDER_KEY_BITS = 64;
+// Bits per coordinate are never more than this, so a coordinate fits in 32 bits
+constexpr int ORDER_MAX_BITS = 32;
+// Bits of the curve index sorted per pass of the radix sort
+constexpr int ORDER_RADIX_BITS = 8;
+
+/**
+ * Readable name of a point order
+ **/
+inline const char* point_order_name(const PointOrder order) {
+    switch (order) {
+        case PointOrder::MORTON: return "morton";
+        case PointOrder::HILBERT: return "hilbert";
+        default: return "file";
+    }
+}
+
+/**
+ * Curve index of a point from its quantized coordinates: the bits of all the coordinates are
+ * interleaved from the most significant one. For the Hilbert curve the coordinates are first
+ * transformed with Skilling's algorithm ("Programming the Hilbert curve", 2004), so consecutive
+ * indices are always neighbouring cells.
+ *
+ * @param q quantized coordinates, modified for the Hilbert curve
+ * @param dims coordinates used
+ * @param bits bits per coordinate
+ * @param order curve to follow
+ *
+ * @return index of the cell along the curve
+ **/
+inline std::uint64_t curve_key(std::uint32_t* q, const int dims, const int bits, const PointOrder order) {
+    if (order == PointOrder::HILBERT) {
+        const std::uint32_t top = 1u << (bits - 1);
+        for (std::uint32_t b = top; b > 1; b >>= 1) {
+            const std::uint32_t low = b - 1;
+            for (int j = 0; j < dims; j++) {
+                if (q[j] & b) {
+                    q[0] ^= low;
+                }
+                else {
+                    std::uint32_t swap = (q[0] ^ q[j]) & low;
+                    q[0] ^= swap;
+                    q[j] ^= swap;
+                }
+            }
+        }
+        for (int j = 1; j < dims; j++) {
+            q[j] ^= q[j - 1];
+        }
+        std::uint32_t flip = 0;
+        for (std::uint32_t b = top; b > 1; b >>= 1) {
+            if (q[dims - 1] & b) flip ^= b - 1;
+        }
+        for (int j = 0; j < dims; j++) {
+            q[j] ^= flip;
+        }
+    }
+
+    std::uint64_t key = 0;
+    for (int b = bits - 1; b >= 0; b--) {
+        for (int j = 0; j < dims; j++) {
+            key = (key << 1) | ((q[j] >> b) & 1u);
+        }
+    }
+    return key;
+}
+
+/**
+ * Stable parallel LSD radix sort of the indices by their keys, ORDER_RADIX_BITS per pass. Every
+ * thread counts the digits of its own range, a prefix sum over (digit, thread) gives where each
+ * thread writes every digit, and each thread then scatters its range. Passes where all the keys
+ * share the digit are skipped. Equal keys keep their order, so the result does not depend on the
+ * number of threads.
+ *
+ * @param keys key of every index, reordered with them
+ * @param index indices to sort
+ * @param key_bits low bits of the keys that may differ
+ **/
+inline void radix_sort_keys(std::vector<std::uint64_t>& keys, std::vector<int>& index, const int key_bits) {
+    constexpr int buckets = 1 << ORDER_RADIX_BITS;
+    const long n = keys.size();
+#ifdef _OPENMP
+    const int max_threads = omp_get_max_threads();
+#else
+    const int max_threads = 1;
+#endif
+    std::vector<long> offsets((std::size_t)max_threads * buckets);
+    std::vector<std::uint64_t> next_keys(n);
+    std::vector<int> next_index(n);
+
+    for (int shift = 0; shift < key_bits; shift += ORDER_RADIX_BITS) {
+        bool skip = false;
+
+        #pragma omp parallel
+        {
+#ifdef _OPENMP
+            const int team_size = omp_get_num_threads();
+            const int thread = omp_get_thread_num();
+#else
+            const int team_size = 1;
+            const int thread = 0;
+#endif
+            const long begin = n * thread / team_size;
+            const long end = n * (thread + 1) / team_size;
+            long* count = offsets.data() + (std::size_t)thread * buckets;
+            std::fill(count, count + buckets, 0);
+            for (long i = begin; i < end; i++) {
+                count[(keys[i] >> shift) & (buckets - 1)]++;
+            }
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                long total = 0;
+                for (int digit = 0; digit < buckets; digit++) {
+                    long digit_total = 0;
+                    for (int t = 0; t < team_size; t++) {
+                        long& offset = offsets[(std::size_t)t * buckets + digit];
+                        long value = offset;
+                        offset = total + digit_total;
+                        digit_total += value;
+                    }
+                    skip = skip || digit_total == n;
+                    total += digit_total;
+                }
+            }
+
+            if (!skip) {
+                for (long i = begin; i < end; i++) {
+                    long& offset = count[(keys[i] >> shift) & (buckets - 1)];
+                    next_keys[offset] = keys[i];
+                    next_index[offset] = index[i];
+                    offset++;
+                }
+            }
+        }
+
+        if (!skip) {
+            keys.swap(next_keys);
+            index.swap(next_index);
+        }
+    }
+}
+
+/**
+ * Sorts the points along a space-filling curve, so points stored close together are also close in
+ * space: consecutive points of an assignment block tend to pick the same centroid, which keeps the
+ * compared centroids and the per-thread sums in cache and the comparisons predictable. Every
+ * coordinate is quantized to the bounding box of the data with as many bits as fit in
+ * ORDER_KEY_BITS for all of them (only the first 64 coordinates are used in higher dimensions,
+ * where a curve orders little anyway); the points are sorted by their curve index with a parallel
+ * radix sort and gathered into a new point set.
+ *
+ * @param data points to reorder, replaced by the reordered copy
+ * @param order curve to follow; nothing is done for PointOrder::FILE
+ * @param permutation where the original index of every reordered point is stored, empty for PointOrder::FILE
+ **/
+template <typename T>
+inline void order_points(BasicPointSet<T>& data, const PointOrder order, std::vector<int>& permutation) {
+    permutation.clear();
+    if (order == PointOrder::FILE || data.size == 0 || data.dim == 0) return;
+
+    const int n = data.size;
+    const int dims = std::min(data.dim, ORDER_KEY_BITS);
+    const int bits = std::min(ORDER_KEY_BITS / dims, ORDER_MAX_BITS);
+    const double cells = (double)((1ull << bits) - 1);
+
+    std::vector<double> lower(dims);
+    std::vector<double> scale(dims);
+    for (int j = 0; j < dims; j++) {
+        const T* x = data.column(j);
+        T low = std::numeric_limits<T>::max();
+        T high = std::numeric_limits<T>::lowest();
+        #pragma omp parallel for schedule(static) reduction(min:low) reduction(max:high)
+        for (int i = 0; i < n; i++) {
+            low = std::min(low, x[i]);
+            high = std::max(high, x[i]);
+        }
+        lower[j] = low;
+        scale[j] = high > low ? cells / ((double)high - low) : 0.0;
+    }
+
+    std::vector<std::uint64_t> keys(n);
+    permutation.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        std::uint32_t q[ORDER_KEY_BITS];
+        for (int j = 0; j < dims; j++) {
+            double cell = ((double)data.column(j)[i] - lower[j]) * scale[j];
+            q[j] = (std::uint32_t)std::min(std::max(cell, 0.0), cells);
+        }
+        keys[i] = curve_key(q, dims, bits, order);
+        permutation[i] = i;
+    }
+    radix_sort_keys(keys, permutation, dims * bits);
+
+    BasicPointSet<T> ordered;
+    alloc_points(ordered, n, data.dim);
+    for (int j = 0; j < data.dim; j++) {
+        const T* x = data.column(j);
+        T* y = ordered.column(j);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            y[i] = x[permutation[i]];
+        }
+    }
+    free_points(data);
+    data = ordered;
+}
+
+/**
+ * Undoes order_points(): puts the points and their assignments back in their original order
+ *
+ * @param ordered reordered points
+ * @param cluster_assignments assigned cluster of every reordered point
+ * @param permutation original index of every reordered point
+ * @param original memory where the points are stored in their original order, allocated here
+ * @param original_assignments memory where the assignments are stored in the original order
+ **/
+template <typename T>
+inline void restore_order(const BasicPointSet<T>& ordered, const int* cluster_assignments, const std::vector<int>& permutation,
+                          BasicPointSet<T>& original, int* original_assignments) {
+    const int n = ordered.size;
+    alloc_points(original, n, ordered.dim);
+    for (int j = 0; j < ordered.dim; j++) {
+        const T* x = ordered.column(j);
+        T* y = original.column(j);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            y[permutation[i]] = x[i];
+        }
+    }
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        original_assignments[permutation[i]] = cluster_assignments[i];
+    }
+}
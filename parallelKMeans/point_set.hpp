@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+
+// Alignment (in bytes) of every column; 64 covers a cache line and a full AVX-512 register
+constexpr std::size_t POINT_ALIGNMENT = 64;
+// Points handled per task in the assignment loop; a multiple of every SIMD width. Memory is first
+// touched with the same blocks so every page lands on the NUMA node of the thread that reads it.
+constexpr int ASSIGN_BLOCK = 1024;
+
+/**
+ * Fills an array in parallel with the static partition of ASSIGN_BLOCK blocks used by the
+ * assignment loop. Linux places a page on the NUMA node of the thread that first writes it, so
+ * with the same number of threads every thread later reads its points from local memory.
+ *
+ * @param values array to fill, not touched before
+ * @param count number of values
+ * @param value value to store
+ **/
+template <typename V>
+inline void first_touch(V* values, const std::size_t count, const V value) {
+    const long num_blocks = (count + ASSIGN_BLOCK - 1) / ASSIGN_BLOCK;
+    #pragma omp parallel for schedule(static) if(num_blocks > 1)
+    for (long b = 0; b < num_blocks; b++) {
+        std::size_t begin = (std::size_t)b * ASSIGN_BLOCK;
+        std::size_t end = std::min(begin + ASSIGN_BLOCK, count);
+        std::fill(values + begin, values + end, value);
+    }
+}
+
+/**
+ * Structure-of-arrays storage for a set of points. All coordinates live in a single aligned
+ * block, one column per dimension: coordinate j of point i is coords[j * stride + i]. The block is
+ * either allocated by alloc_points() or part of a mapped file (mapping is then the start of the map).
+ *
+ * @tparam T type of the coordinates, double or float
+ **/
+template <typename T>
+struct BasicPointSet {
+    using value_type = T;
+    // Columns are padded to a multiple of this many values so SIMD loads never leave the block
+    static constexpr int padding = POINT_ALIGNMENT / sizeof(T);
+
+    int size = 0;
+    int dim = 0;
+    int stride = 0;
+    T* coords = nullptr;
+    void* mapping = nullptr;
+    std::size_t mapped_bytes = 0;
+
+    T* column(const int j) { return coords + (std::size_t)j * stride; }
+    const T* column(const int j) const { return coords + (std::size_t)j * stride; }
+};
+
+using PointSet = BasicPointSet<double>;
+using PointSetF32 = BasicPointSet<float>;
+
+/**
+ * Allocates the aligned block for a point set. Padding cells are zeroed so that vector loads
+ * past the last point read well-defined values. Every column is zeroed with first_touch(), which
+ * places the points of each thread on its NUMA node before the data is loaded.
+ *
+ * @param points point set to allocate
+ * @param size number of points
+ * @param dim dimension of each point
+ **/
+template <typename T>
+inline void alloc_points(BasicPointSet<T>& points, const int size, const int dim) {
+    constexpr int padding = BasicPointSet<T>::padding;
+    points.size = size;
+    points.dim = dim;
+    points.stride = (size + padding - 1) / padding * padding;
+
+    std::size_t bytes = (std::size_t)points.stride * dim * sizeof(T);
+    if (bytes == 0) bytes = POINT_ALIGNMENT;
+    points.coords = static_cast<T*>(std::aligned_alloc(POINT_ALIGNMENT, bytes));
+    if (dim == 0) {
+        std::memset(points.coords, 0, bytes);
+    }
+    for (int j = 0; j < dim; j++) {
+        first_touch(points.column(j), points.stride, T(0));
+    }
+}
+
+/**
+ * Releases the memory (or the file mapping) of a point set and leaves it empty
+ *
+ * @param points point set to free
+ **/
+template <typename T>
+inline void free_points(BasicPointSet<T>& points) {
+    if (points.mapping) {
+        munmap(points.mapping, points.mapped_bytes);
+    }
+    else {
+        std::free(points.coords);
+    }
+    points = BasicPointSet<T>();
+}
+
+/**
+ * Copies the points of one set into another, which is (re)allocated unless it already has the
+ * same shape
+ *
+ * @param from points to copy
+ * @param to point set that receives the copy
+ **/
+template <typename T>
+inline void copy_points(const BasicPointSet<T>& from, BasicPointSet<T>& to) {
+    if (!to.coords || to.mapping || to.size != from.size || to.dim != from.dim) {
+        free_points(to);
+        alloc_points(to, from.size, from.dim);
+    }
+    for (int j = 0; j < from.dim; j++) {
+        std::copy(from.column(j), from.column(j) + from.size, to.column(j));
+    }
+}
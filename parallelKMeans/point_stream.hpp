@@ -0,0 +1,322 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "point_set.hpp"
+#include "csv_io.hpp"
+#include "binary_points.hpp"
+
+// Bytes of a csv read per system call while streaming; grown if a single line is longer
+constexpr std::size_t STREAM_READ_BYTES = 1 << 22;
+
+/**
+ * Sequential reader of a point file in batches, for files that do not fit in memory. Binary point
+ * files are read with one pread per column; csv files are read in blocks of STREAM_READ_BYTES and
+ * parsed line by line, keeping the partial line at the end of a block for the next one.
+ *
+ * fd: open file
+ * binary: whether the file is a binary point file
+ * dim: dimension of the points
+ * size, stride: points and column stride of a binary file
+ * next: index of the next point to read
+ * text: read buffer of a csv, the unparsed bytes are [text_begin, text_end)
+ * eof: whether the whole csv has been read into the buffer
+ * errors: csv lines skipped so far because they are not points
+ **/
+template <typename T>
+struct PointStream {
+    int fd = -1;
+    bool binary = false;
+    int dim = 0;
+    std::uint64_t size = 0;
+    std::uint64_t stride = 0;
+    std::uint64_t next = 0;
+    std::vector<char> text;
+    std::size_t text_begin = 0;
+    std::size_t text_end = 0;
+    bool eof = false;
+    long errors = 0;
+};
+
+/**
+ * Reads a range of a file at an offset, retrying short reads
+ *
+ * @return bytes read, less than size only at the end of the file; -1 on error
+ **/
+inline long read_at(const int fd, char* bytes, std::size_t size, off_t offset) {
+    long total = 0;
+    while (size > 0) {
+        ssize_t count = pread(fd, bytes, size, offset);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (count == 0) break;
+        bytes += count;
+        size -= count;
+        offset += count;
+        total += count;
+    }
+    return total;
+}
+
+/**
+ * Reads more of a csv into the buffer of a stream, after moving the unparsed bytes to its start
+ *
+ * @param stream csv stream
+ *
+ * @return false on a read error
+ **/
+template <typename T>
+inline bool stream_refill(PointStream<T>& stream) {
+    std::vector<char>& text = stream.text;
+    std::size_t pending = stream.text_end - stream.text_begin;
+    std::memmove(text.data(), text.data() + stream.text_begin, pending);
+    stream.text_begin = 0;
+    stream.text_end = pending;
+    if (pending == text.size()) {
+        text.resize(2 * text.size());
+    }
+
+    while (true) {
+        ssize_t count = read(stream.fd, text.data() + stream.text_end, text.size() - stream.text_end);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) return false;
+        if (count == 0) stream.eof = true;
+        stream.text_end += count;
+        return true;
+    }
+}
+
+/**
+ * Goes back to the first point of a stream
+ *
+ * @param stream stream to rewind
+ **/
+template <typename T>
+inline void stream_rewind(PointStream<T>& stream) {
+    stream.next = 0;
+    stream.errors = 0;
+    if (!stream.binary) {
+        lseek(stream.fd, 0, SEEK_SET);
+        stream.text_begin = 0;
+        stream.text_end = 0;
+        stream.eof = false;
+    }
+}
+
+/**
+ * Closes the file of a stream
+ **/
+template <typename T>
+inline void stream_close(PointStream<T>& stream) {
+    if (stream.fd >= 0) {
+        close(stream.fd);
+    }
+    stream = PointStream<T>();
+}
+
+/**
+ * Opens a point file for streaming: binary point files (.bin, of type T) or csv, whose dimension
+ * is taken from its first line
+ *
+ * @param filename name of the file with the points
+ * @param stream stream to open
+ *
+ * @return false if the file could not be opened or is not a valid point file
+ **/
+template <typename T>
+inline bool stream_open(const std::string& filename, PointStream<T>& stream) {
+    stream = PointStream<T>();
+    stream.fd = open(filename.c_str(), O_RDONLY);
+    if (stream.fd < 0) {
+        std::cerr << "Error: could not open " << filename << std::endl;
+        return false;
+    }
+    posix_fadvise(stream.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (is_binary_points(filename)) {
+        BinaryPointsHeader header;
+        struct stat info;
+        bool valid = fstat(stream.fd, &info) == 0
+                     && read_at(stream.fd, reinterpret_cast<char*>(&header), sizeof(header), 0) == sizeof(header)
+                     && std::memcmp(header.magic, BINARY_POINTS_MAGIC, sizeof(header.magic)) == 0
+                     && header.version == BINARY_POINTS_VERSION
+                     && header.dtype == static_cast<std::uint32_t>(point_type<T>())
+                     && header.stride >= header.size
+                     && (std::size_t)info.st_size >= sizeof(header) + header.stride * header.dim * sizeof(T);
+        if (!valid) {
+            std::cerr << "Error: " << filename << " is not a valid point file of " << point_type_name(static_cast<std::uint32_t>(point_type<T>()))
+                      << " points" << std::endl;
+            stream_close(stream);
+            return false;
+        }
+        stream.binary = true;
+        stream.dim = header.dim;
+        stream.size = header.size;
+        stream.stride = header.stride;
+        return true;
+    }
+
+    stream.text.resize(STREAM_READ_BYTES);
+    if (!stream_refill(stream)) {
+        std::cerr << "Error: could not read " << filename << std::endl;
+        stream_close(stream);
+        return false;
+    }
+    MappedFile head;
+    head.bytes = stream.text.data();
+    head.size = stream.text_end;
+    stream.dim = detect_dim(head);
+    return true;
+}
+
+/**
+ * Reads the next points of a stream into a batch
+ *
+ * @param stream open stream
+ * @param batch point set allocated with capacity points; its size is set to the points read
+ * @param capacity most points to read
+ *
+ * @return points read, 0 at the end of the file or on a read error
+ **/
+template <typename T>
+inline int stream_read(PointStream<T>& stream, BasicPointSet<T>& batch, const int capacity) {
+    int count = 0;
+    if (stream.binary) {
+        count = std::min<std::uint64_t>(capacity, stream.size - stream.next);
+        for (int j = 0; j < stream.dim && count > 0; j++) {
+            off_t offset = sizeof(BinaryPointsHeader) + (j * stream.stride + stream.next) * sizeof(T);
+            if (read_at(stream.fd, reinterpret_cast<char*>(batch.column(j)), count * sizeof(T), offset) != (long)(count * sizeof(T))) {
+                std::cerr << "Error: could not read the points of the stream" << std::endl;
+                count = 0;
+            }
+        }
+    }
+    else {
+        while (count < capacity) {
+            const char* begin = stream.text.data() + stream.text_begin;
+            const char* end = stream.text.data() + stream.text_end;
+            const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+            if (!newline && !stream.eof) {
+                if (!stream_refill(stream)) {
+                    std::cerr << "Error: could not read the points of the stream" << std::endl;
+                    break;
+                }
+                continue;
+            }
+            if (!newline && begin == end) break;
+
+            const char* line_end = newline ? newline : end;
+            if (!blank_line(begin, line_end)) {
+                if (parse_point(begin, line_end, batch, count)) count++;
+                else stream.errors++;
+            }
+            stream.text_begin = line_end - stream.text.data() + (newline ? 1 : 0);
+        }
+    }
+    stream.next += count;
+    batch.size = count;
+    return count;
+}
+
+/**
+ * Double-buffered batch reader: a background thread reads the next batch of a stream while the
+ * caller works on the current one. Only two batches are ever allocated, so memory use depends on
+ * the batch size and not on the size of the file. Every pass over the file uses its own reader.
+ *
+ * @tparam T type of the coordinates
+ **/
+template <typename T>
+class BatchReader {
+public:
+    /**
+     * Starts reading the first batch from the current position of the stream
+     *
+     * @param stream open stream, used by the reader thread until the reader is destroyed
+     * @param batch_size points per batch
+     **/
+    BatchReader(PointStream<T>& stream, const int batch_size) : stream_(stream), batch_size_(batch_size) {
+        for (BasicPointSet<T>& batch : batches_) {
+            alloc_points(batch, batch_size, stream.dim);
+        }
+        thread_ = std::thread(&BatchReader::read_batches, this);
+    }
+
+    ~BatchReader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_all();
+        thread_.join();
+        for (BasicPointSet<T>& batch : batches_) {
+            free_points(batch);
+        }
+    }
+
+    BatchReader(const BatchReader&) = delete;
+    BatchReader& operator=(const BatchReader&) = delete;
+
+    /**
+     * Waits for the next batch and hands the previous one back to the reader thread
+     *
+     * @return next batch, valid until the following call; nullptr after the last one
+     **/
+    const BasicPointSet<T>* next() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (held_ >= 0) {
+            filled_[held_] = false;
+            held_ = -1;
+            ready_.notify_all();
+        }
+        ready_.wait(lock, [this] { return filled_[current_]; });
+        if (batches_[current_].size == 0) return nullptr;
+        held_ = current_;
+        current_ ^= 1;
+        return &batches_[held_];
+    }
+
+private:
+    /**
+     * Body of the reader thread: fills the two batches in turn, each once the caller released it
+     **/
+    void read_batches() {
+        for (int slot = 0; ; slot ^= 1) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this, slot] { return stop_ || !filled_[slot]; });
+                if (stop_) return;
+            }
+            int count = stream_read(stream_, batches_[slot], batch_size_);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                filled_[slot] = true;
+            }
+            ready_.notify_all();
+            if (count == 0) return;
+        }
+    }
+
+    PointStream<T>& stream_;
+    const int batch_size_;
+    BasicPointSet<T> batches_[2];
+    bool filled_[2] = {false, false};
+    int current_ = 0;
+    int held_ = -1;
+    bool stop_ = false;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::thread thread_;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "point_set.hpp"
+
+// Rows formatted by each task of the result writer
+constexpr int WRITE_CHUNK = 1 << 15;
+// Room reserved for one formatted value and its separator; %g with 6 digits needs at most 13
+constexpr int MAX_VALUE_CHARS = 24;
+
+/**
+ * Text of the results, formatted in independent chunks of WRITE_CHUNK rows
+ *
+ * chunks: text of every chunk
+ * offsets: byte offset of every chunk in the text, followed by the total size
+ **/
+struct FormattedRows {
+    std::vector<std::unique_ptr<char[]>> chunks;
+    std::vector<std::size_t> offsets;
+};
+
+/**
+ * Formats one row of the results: the coordinates of the point followed by its cluster. Values are
+ * printed like std::ostream does by default (%g with 6 significant digits), so the files do not
+ * change with respect to the streamed writer.
+ *
+ * @param cursor where the row is written, with room for (dim + 1) * MAX_VALUE_CHARS characters
+ * @param data points used during the algorithm
+ * @param cluster_assignments assigned cluster for each point
+ * @param i index of the point
+ *
+ * @return one past the last character written
+ **/
+template <typename T>
+inline char* format_row(char* cursor, const BasicPointSet<T>& data, const int* cluster_assignments, const int i) {
+    for (int j = 0; j < data.dim; j++) {
+        cursor = std::to_chars(cursor, cursor + MAX_VALUE_CHARS - 1, data.column(j)[i], std::chars_format::general, 6).ptr;
+        *cursor++ = ',';
+    }
+    cursor = std::to_chars(cursor, cursor + MAX_VALUE_CHARS - 1, cluster_assignments[i]).ptr;
+    *cursor++ = '\n';
+    return cursor;
+}
+
+/**
+ * Formats the results in parallel, every chunk of rows into its own buffer, and computes where
+ * each chunk goes in the file. The buffers hold the whole text until it is written.
+ *
+ * @param data points used during the algorithm
+ * @param cluster_assignments assigned cluster for each point
+ *
+ * @return text of every chunk and its offset
+ **/
+template <typename T>
+inline FormattedRows format_results(const BasicPointSet<T>& data, const int* cluster_assignments) {
+    const int num_chunks = (data.size + WRITE_CHUNK - 1) / WRITE_CHUNK;
+    const std::size_t row_chars = (std::size_t)(data.dim + 1) * MAX_VALUE_CHARS;
+    FormattedRows rows;
+    rows.chunks.resize(num_chunks);
+    rows.offsets.assign(num_chunks + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < num_chunks; c++) {
+        int begin = c * WRITE_CHUNK;
+        int end = std::min(begin + WRITE_CHUNK, data.size);
+        rows.chunks[c].reset(new char[row_chars * (end - begin)]);
+        char* cursor = rows.chunks[c].get();
+        for (int i = begin; i < end; i++) {
+            cursor = format_row(cursor, data, cluster_assignments, i);
+        }
+        rows.offsets[c + 1] = cursor - rows.chunks[c].get();
+    }
+    for (int c = 0; c < num_chunks; c++) {
+        rows.offsets[c + 1] += rows.offsets[c];
+    }
+    return rows;
+}
+
+/**
+ * Writes a buffer at an offset of a file, retrying short writes
+ *
+ * @return false if the write failed
+ **/
+inline bool write_at(const int fd, const char* bytes, std::size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+/**
+ * Writes every formatted chunk at its offset, the chunks in parallel
+ *
+ * @param fd file open for writing
+ * @param rows formatted chunks
+ * @param base offset of the first chunk in the file
+ *
+ * @return false if any write failed
+ **/
+inline bool write_rows(const int fd, const FormattedRows& rows, const off_t base = 0) {
+    const int num_chunks = rows.chunks.size();
+    int failures = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:failures)
+    for (int c = 0; c < num_chunks; c++) {
+        if (!write_at(fd, rows.chunks[c].get(), rows.offsets[c + 1] - rows.offsets[c], base + rows.offsets[c])) {
+            failures++;
+        }
+    }
+    return failures == 0;
+}
+
+/**
+ * Opens a result file for writing
+ *
+ * @param filename name of the file
+ * @param truncate whether previous contents are discarded
+ *
+ * @return file descriptor, negative if the file could not be opened
+ **/
+inline int open_results(const std::string& filename, const bool truncate) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        std::cerr << "Error: could not open " << filename << " for writing" << std::endl;
+    }
+    return fd;
+}
+
+/**
+ * Writes the results of the k-means algorithm into a csv file: the rows are formatted in parallel
+ * with std::to_chars and written with one large pwrite per chunk
+ *
+ * @param filename name of the file where the results will be stored
+ * @param data points used during the algorithm
+ * @param cluster_assignments assigned cluster for each value
+ *
+ * @return false if the file could not be written
+ **/
+template <typename T>
+bool write_csv(const std::string& filename, const BasicPointSet<T>& data, int* cluster_assignments) {
+    FormattedRows rows = format_results(data, cluster_assignments);
+    int fd = open_results(filename, true);
+    if (fd < 0) return false;
+    bool written = write_rows(fd, rows);
+    close(fd);
+    if (!written) {
+        std::cerr << "Error: could not write " << filename << std::endl;
+    }
+    return written;
+}
+
+/**
+ * Writes only the assignments as consecutive native int32 values, without header; e.g.
+ * numpy.fromfile(filename, dtype=numpy.int32) reads them back
+ *
+ * @param filename name of the file where the assignments will be stored
+ * @param cluster_assignments assigned cluster for each point
+ * @param size number of points
+ * @param first index of the first point in the file, for files written in parts
+ * @param truncate whether previous contents are discarded
+ *
+ * @return false if the file could not be written
+ **/
+inline bool write_assignments(const std::string& filename, const int* cluster_assignments, const std::size_t size,
+                              const std::size_t first = 0, const bool truncate = true) {
+    static_assert(sizeof(int) == sizeof(std::int32_t), "assignments are stored as int32");
+    int fd = open_results(filename, truncate);
+    if (fd < 0) return false;
+    bool written = write_at(fd, reinterpret_cast<const char*>(cluster_assignments), size * sizeof(int), first * sizeof(int));
+    close(fd);
+    if (!written) {
+        std::cerr << "Error: could not write " << filename << std::endl;
+    }
+    return written;
+}
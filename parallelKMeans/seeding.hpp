@@ -0,0 +1,536 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "point_set.hpp"
+#include "distance_kernels.hpp"
+
+// Points per block when summing distances; fixed so results do not depend on the number of threads
+constexpr int SEED_BLOCK = 4096;
+// Power iterations that find the main axis of a cluster before it is split
+constexpr int SPLIT_POWER_ITERATIONS = 4;
+// Distance from the mean of each half of a normal distribution to its center, in standard deviations
+constexpr double SPLIT_OFFSET = 0.7978845608;
+
+// Ways of choosing the initial centroids
+enum class SeedingMethod {
+    RANDOM,             // uniform coordinates in [0, 1), ignores the data
+    KMEANS_PLUS_PLUS,   // k-means++: one pass over the data per centroid
+    KMEANS_PARALLEL,    // k-means||: oversampled rounds followed by k-means++ on the weighted candidates
+    KEEP                // the centroids already in place, e.g. from split_cluster() for a warm start
+};
+
+/**
+ * Settings for seed_centroids()
+ *
+ * method: seeding algorithm
+ * seed: user seed; the same seed gives the same centroids regardless of the number of threads
+ * rounds: oversampling rounds of k-means||
+ * oversampling: expected candidates picked per round by k-means||, as a multiple of the number of centroids
+ **/
+struct SeedingOptions {
+    SeedingMethod method = SeedingMethod::KMEANS_PARALLEL;
+    std::uint64_t seed = 0;
+    int rounds = 5;
+    double oversampling = 2.0;
+};
+
+/**
+ * SplitMix64 finalizer, used as a counter-based random generator
+ *
+ * @param x counter to scramble
+ *
+ * @return scrambled 64-bit value
+ **/
+inline std::uint64_t splitmix64(std::uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Uniform number in [0, 1) for a given seed, stream and counter. Since there is no shared state,
+ * every thread can draw the value of any point without synchronization.
+ *
+ * @param seed user seed
+ * @param stream independent sequence (one per seeding step)
+ * @param counter position within the stream, usually the index of a point
+ *
+ * @return uniform double in [0, 1)
+ **/
+inline double random_uniform(const std::uint64_t seed, const std::uint64_t stream, const std::uint64_t counter) {
+    std::uint64_t bits = splitmix64(splitmix64(seed ^ splitmix64(stream)) + counter);
+    return (bits >> 11) * 0x1.0p-53;
+}
+
+/**
+ * Copies point i of a set into centroid c
+ *
+ * @param points point set
+ * @param i index of the point
+ * @param centroids centroid set
+ * @param c index of the centroid
+ **/
+template <typename T>
+inline void copy_point(const BasicPointSet<T>& points, const int i, BasicPointSet<T>& centroids, const int c) {
+    for (int j = 0; j < points.dim; j++) {
+        centroids.column(j)[c] = points.column(j)[i];
+    }
+}
+
+/**
+ * Lowers the squared distance of every point to its closest centroid with centroids [first, last),
+ * and stores the (weighted) sum of each block of SEED_BLOCK points
+ *
+ * @param points point set
+ * @param weights weight of each point, nullptr for all ones
+ * @param centroids centroid set
+ * @param first first centroid to consider
+ * @param last one past the last centroid to consider
+ * @param min_distance squared distance of each point to its closest centroid so far
+ * @param block_sums weighted sum of min_distance per block
+ **/
+template <typename T>
+inline void update_min_distance(const BasicPointSet<T>& points, const double* weights, const BasicPointSet<T>& centroids, const int first, const int last, double* min_distance, double* block_sums) {
+    const int num_blocks = (points.size + SEED_BLOCK - 1) / SEED_BLOCK;
+
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < num_blocks; b++) {
+        const int begin = b * SEED_BLOCK;
+        const int count = std::min(begin + SEED_BLOCK, points.size) - begin;
+        double* block_min = min_distance + begin;
+        T distance[SEED_BLOCK];
+
+        // Coordinate-major loops so the compiler vectorizes across the points of the block
+        for (int c = first; c < last; c++) {
+            std::fill(distance, distance + count, T(0));
+            for (int j = 0; j < points.dim; j++) {
+                const T* x = points.column(j) + begin;
+                const T center = centroids.column(j)[c];
+                for (int i = 0; i < count; i++) {
+                    T diff = x[i] - center;
+                    distance[i] += diff * diff;
+                }
+            }
+            for (int i = 0; i < count; i++) {
+                block_min[i] = std::min(block_min[i], (double)distance[i]);
+            }
+        }
+
+        double sum = 0.0;
+        for (int i = 0; i < count; i++) {
+            sum += weights ? weights[begin + i] * block_min[i] : block_min[i];
+        }
+        block_sums[b] = sum;
+    }
+}
+
+/**
+ * Draws a point with probability proportional to its weighted squared distance, walking the block
+ * sums first and then the points of the chosen block. If every distance is zero the point is drawn uniformly.
+ *
+ * @param points point set
+ * @param weights weight of each point, nullptr for all ones
+ * @param min_distance squared distance of each point to its closest centroid
+ * @param block_sums weighted sum of min_distance per block
+ * @param u uniform number in [0, 1)
+ *
+ * @return index of the chosen point
+ **/
+template <typename T>
+inline int sample_point(const BasicPointSet<T>& points, const double* weights, const double* min_distance, const double* block_sums, const double u) {
+    const int num_blocks = (points.size + SEED_BLOCK - 1) / SEED_BLOCK;
+    double total = 0.0;
+    for (int b = 0; b < num_blocks; b++) {
+        total += block_sums[b];
+    }
+    if (total <= 0.0) {
+        return std::min((int)(u * points.size), points.size - 1);
+    }
+
+    double target = u * total;
+    int b = 0;
+    while (b < num_blocks - 1 && target >= block_sums[b]) {
+        target -= block_sums[b];
+        b++;
+    }
+
+    int end = std::min((b + 1) * SEED_BLOCK, points.size);
+    int chosen = -1;
+    for (int i = b * SEED_BLOCK; i < end; i++) {
+        double mass = weights ? weights[i] * min_distance[i] : min_distance[i];
+        if (mass <= 0.0) continue;
+        chosen = i;
+        if (target < mass) break;
+        target -= mass;
+    }
+    return chosen >= 0 ? chosen : std::min((int)(u * points.size), points.size - 1);
+}
+
+/**
+ * k-means++ seeding: the first centroid is drawn proportionally to the weights (uniformly without
+ * them) and every following one with probability proportional to its weighted squared distance
+ * to the closest chosen centroid
+ *
+ * @param points point set
+ * @param weights weight of each point, nullptr for all ones
+ * @param centroids memory where the centroids will be stored
+ * @param seed user seed
+ * @param stream first random stream to use
+ **/
+template <typename T>
+inline void kmeans_plus_plus(const BasicPointSet<T>& points, const double* weights, BasicPointSet<T>& centroids, const std::uint64_t seed, const std::uint64_t stream) {
+    std::vector<double> min_distance(points.size, DBL_MAX);
+    std::vector<double> block_sums((points.size + SEED_BLOCK - 1) / SEED_BLOCK);
+
+    int first = std::min((int)(random_uniform(seed, stream, 0) * points.size), points.size - 1);
+    if (weights) {
+        std::vector<double> ones(points.size, 1.0);
+        std::fill(block_sums.begin(), block_sums.end(), 0.0);
+        for (int i = 0; i < points.size; i++) {
+            block_sums[i / SEED_BLOCK] += weights[i];
+        }
+        first = sample_point(points, weights, ones.data(), block_sums.data(), random_uniform(seed, stream, 0));
+    }
+    copy_point(points, first, centroids, 0);
+
+    for (int c = 1; c < centroids.size; c++) {
+        update_min_distance(points, weights, centroids, c - 1, c, min_distance.data(), block_sums.data());
+        int chosen = sample_point(points, weights, min_distance.data(), block_sums.data(), random_uniform(seed, stream + c, 0));
+        copy_point(points, chosen, centroids, c);
+    }
+}
+
+/**
+ * k-means|| seeding: starting from one uniformly drawn point, every round samples each point
+ * independently with probability oversampling * k * d^2 / cost, which is a single parallel pass
+ * over the data. The candidates are then weighted by the number of points closest to them and
+ * reduced to k centroids with k-means++.
+ *
+ * @param points point set
+ * @param centroids memory where the centroids will be stored
+ * @param options seeding settings
+ **/
+template <typename T>
+inline void kmeans_parallel(const BasicPointSet<T>& points, BasicPointSet<T>& centroids, const SeedingOptions& options) {
+    const int num_blocks = (points.size + SEED_BLOCK - 1) / SEED_BLOCK;
+    const double expected = options.oversampling * centroids.size;
+    std::vector<double> min_distance(points.size, DBL_MAX);
+    std::vector<double> block_sums(num_blocks);
+    std::vector<std::vector<int>> block_picks(num_blocks);
+
+    std::vector<int> candidates;
+    candidates.push_back(std::min((int)(random_uniform(options.seed, 0, 0) * points.size), points.size - 1));
+
+    BasicPointSet<T> chosen;
+    alloc_points(chosen, 1, points.dim);
+    copy_point(points, candidates[0], chosen, 0);
+    update_min_distance(points, nullptr, chosen, 0, 1, min_distance.data(), block_sums.data());
+    free_points(chosen);
+
+    for (int round = 1; round <= options.rounds; round++) {
+        double cost = 0.0;
+        for (int b = 0; b < num_blocks; b++) {
+            cost += block_sums[b];
+        }
+        if (cost <= 0.0) break;
+
+        // Every point is drawn with its own counter, so the picks do not depend on the schedule
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < num_blocks; b++) {
+            block_picks[b].clear();
+            int end = std::min((b + 1) * SEED_BLOCK, points.size);
+            for (int i = b * SEED_BLOCK; i < end; i++) {
+                if (random_uniform(options.seed, round, i) < expected * min_distance[i] / cost) {
+                    block_picks[b].push_back(i);
+                }
+            }
+        }
+
+        int first_new = candidates.size();
+        for (int b = 0; b < num_blocks; b++) {
+            candidates.insert(candidates.end(), block_picks[b].begin(), block_picks[b].end());
+        }
+        if ((int)candidates.size() == first_new) continue;
+
+        alloc_points(chosen, candidates.size() - first_new, points.dim);
+        for (int c = first_new; c < (int)candidates.size(); c++) {
+            copy_point(points, candidates[c], chosen, c - first_new);
+        }
+        update_min_distance(points, nullptr, chosen, 0, chosen.size, min_distance.data(), block_sums.data());
+        free_points(chosen);
+    }
+
+    if ((int)candidates.size() <= centroids.size) {
+        kmeans_plus_plus(points, nullptr, centroids, options.seed, options.rounds + 1);
+        return;
+    }
+
+    // Weight every candidate by the number of points that are closest to it
+    BasicPointSet<T> candidate_points;
+    alloc_points(candidate_points, candidates.size(), points.dim);
+    for (int c = 0; c < (int)candidates.size(); c++) {
+        copy_point(points, candidates[c], candidate_points, c);
+    }
+
+    std::vector<double> weights(candidates.size(), 0.0);
+    std::vector<int> labels(points.size);
+    #pragma omp parallel
+    {
+        std::vector<double> local_weights(candidates.size(), 0.0);
+
+        #pragma omp for schedule(static)
+        for (int b = 0; b < num_blocks; b++) {
+            int begin = b * SEED_BLOCK;
+            int end = std::min(begin + SEED_BLOCK, points.size);
+            assign_points(points, candidate_points, begin, end, labels.data());
+            for (int i = begin; i < end; i++) {
+                local_weights[labels[i]] += 1.0;
+            }
+        }
+
+        #pragma omp critical
+        for (int c = 0; c < (int)candidates.size(); c++) {
+            weights[c] += local_weights[c];
+        }
+    }
+
+    kmeans_plus_plus(candidate_points, weights.data(), centroids, options.seed, options.rounds + 1);
+    free_points(candidate_points);
+}
+
+/**
+ * Chooses the initial centroids
+ *
+ * @param points point set
+ * @param centroids memory where the centroids will be stored
+ * @param options seeding settings
+ **/
+template <typename T>
+inline void seed_centroids(const BasicPointSet<T>& points, BasicPointSet<T>& centroids, const SeedingOptions& options) {
+    if (options.method == SeedingMethod::KEEP) {
+        return;
+    }
+    if (options.method == SeedingMethod::RANDOM || points.size == 0) {
+        #pragma omp parallel for collapse(2)
+        for (int i = 0; i < centroids.size; i++) {
+            for (int j = 0; j < centroids.dim; j++) {
+                centroids.column(j)[i] = random_uniform(options.seed, j, i);
+            }
+        }
+    }
+    else if (options.method == SeedingMethod::KMEANS_PLUS_PLUS) {
+        kmeans_plus_plus(points, nullptr, centroids, options.seed, 0);
+    }
+    else {
+        kmeans_parallel(points, centroids, options);
+    }
+}
+
+/**
+ * Squared distance of the points of every cluster to its centroid and number of points of every
+ * cluster. Blocks of SEED_BLOCK points are reduced in order, so the result does not depend on the
+ * number of threads.
+ *
+ * @param points point set
+ * @param centroids centroid set
+ * @param cluster_assignments cluster of each point
+ * @param inertia where the inertia of every cluster is stored
+ * @param counts where the number of points of every cluster is stored
+ **/
+template <typename T>
+inline void cluster_inertia(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int* cluster_assignments,
+                            std::vector<double>& inertia, std::vector<long>& counts) {
+    const int num_blocks = (points.size + SEED_BLOCK - 1) / SEED_BLOCK;
+    const int num_centroids = centroids.size;
+    std::vector<double> block_inertia((std::size_t)num_blocks * num_centroids, 0.0);
+    std::vector<long> block_counts((std::size_t)num_blocks * num_centroids, 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < num_blocks; b++) {
+        const int end = std::min((b + 1) * SEED_BLOCK, points.size);
+        double* sums = block_inertia.data() + (std::size_t)b * num_centroids;
+        long* block = block_counts.data() + (std::size_t)b * num_centroids;
+        for (int i = b * SEED_BLOCK; i < end; i++) {
+            sums[cluster_assignments[i]] += squared_distance(points, i, centroids, cluster_assignments[i]);
+            block[cluster_assignments[i]]++;
+        }
+    }
+
+    inertia.assign(num_centroids, 0.0);
+    counts.assign(num_centroids, 0);
+    for (int b = 0; b < num_blocks; b++) {
+        for (int c = 0; c < num_centroids; c++) {
+            inertia[c] += block_inertia[(std::size_t)b * num_centroids + c];
+            counts[c] += block_counts[(std::size_t)b * num_centroids + c];
+        }
+    }
+}
+
+/**
+ * Scatter of one cluster around a center: with a direction v, the sum over its points of
+ * (x - center) ((x - center) · v), i.e. the unnormalized covariance times v; without one, the sum
+ * of (x - center)^2 for every coordinate. Reduced in blocks like cluster_inertia().
+ *
+ * @param points point set
+ * @param cluster_assignments cluster of each point
+ * @param cluster cluster to measure
+ * @param center center of the cluster
+ * @param direction vector to multiply by the covariance, nullptr for the per-coordinate variance
+ * @param scatter where the dim values are stored
+ **/
+template <typename T>
+inline void cluster_scatter(const BasicPointSet<T>& points, const int* cluster_assignments, const int cluster,
+                            const double* center, const double* direction, double* scatter) {
+    const int num_blocks = (points.size + SEED_BLOCK - 1) / SEED_BLOCK;
+    const int dim = points.dim;
+    std::vector<double> block_scatter((std::size_t)num_blocks * dim, 0.0);
+
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < num_blocks; b++) {
+        const int end = std::min((b + 1) * SEED_BLOCK, points.size);
+        double* sums = block_scatter.data() + (std::size_t)b * dim;
+        for (int i = b * SEED_BLOCK; i < end; i++) {
+            if (cluster_assignments[i] != cluster) continue;
+            double projection = 0.0;
+            if (direction) {
+                for (int j = 0; j < dim; j++) {
+                    projection += (points.column(j)[i] - center[j]) * direction[j];
+                }
+            }
+            for (int j = 0; j < dim; j++) {
+                double diff = points.column(j)[i] - center[j];
+                sums[j] += direction ? diff * projection : diff * diff;
+            }
+        }
+    }
+
+    std::fill(scatter, scatter + dim, 0.0);
+    for (int b = 0; b < num_blocks; b++) {
+        for (int j = 0; j < dim; j++) {
+            scatter[j] += block_scatter[(std::size_t)b * dim + j];
+        }
+    }
+}
+
+/**
+ * Point farthest from the centroid of its cluster, found in blocks like cluster_inertia()
+ *
+ * @param points point set
+ * @param centroids centroids of a converged run
+ * @param cluster_assignments cluster of each point in that run
+ *
+ * @return index of the point, the first one on ties; -1 without points
+ **/
+template <typename T>
+inline int farthest_point(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int* cluster_assignments) {
+    const int num_blocks = (points.size + SEED_BLOCK - 1) / SEED_BLOCK;
+    std::vector<double> block_distance(num_blocks, -1.0);
+    std::vector<int> block_point(num_blocks, -1);
+
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < num_blocks; b++) {
+        const int end = std::min((b + 1) * SEED_BLOCK, points.size);
+        for (int i = b * SEED_BLOCK; i < end; i++) {
+            double distance = squared_distance(points, i, centroids, cluster_assignments[i]);
+            if (distance > block_distance[b]) {
+                block_distance[b] = distance;
+                block_point[b] = i;
+            }
+        }
+    }
+
+    int farthest = -1;
+    double distance = -1.0;
+    for (int b = 0; b < num_blocks; b++) {
+        if (block_distance[b] > distance) {
+            distance = block_distance[b];
+            farthest = block_point[b];
+        }
+    }
+    return farthest;
+}
+
+/**
+ * Warm start for one more centroid: the cluster with the highest inertia is split in two along
+ * its main axis, found with a few power iterations of its covariance from the per-coordinate
+ * deviations. The two halves are placed SPLIT_OFFSET standard deviations away from the centroid
+ * on each side, where the means of the halves of a normal cluster would be. The other centroids
+ * are kept as they are. A cluster without spread cannot be split that way, so then the new
+ * centroid is the point farthest from its centroid (see farthest_point()) instead of a copy of
+ * the widest centroid.
+ *
+ * @param points point set
+ * @param centroids centroids of a converged run
+ * @param cluster_assignments cluster of each point in that run
+ * @param split where the centroids plus the new one are stored, with centroids.size + 1 centroids
+ *
+ * @return index of the cluster that was split, or of the cluster of the farthest point; the new
+ *         centroid is the last one
+ **/
+template <typename T>
+inline int split_cluster(const BasicPointSet<T>& points, const BasicPointSet<T>& centroids, const int* cluster_assignments, BasicPointSet<T>& split) {
+    const int dim = points.dim;
+    const int num_centroids = centroids.size;
+    for (int j = 0; j < dim; j++) {
+        std::copy(centroids.column(j), centroids.column(j) + num_centroids, split.column(j));
+    }
+
+    std::vector<double> inertia;
+    std::vector<long> counts;
+    cluster_inertia(points, centroids, cluster_assignments, inertia, counts);
+    const int widest = std::max_element(inertia.begin(), inertia.end()) - inertia.begin();
+
+    std::vector<double> center(dim);
+    std::vector<double> axis(dim);
+    std::vector<double> scatter(dim);
+    for (int j = 0; j < dim; j++) {
+        center[j] = centroids.column(j)[widest];
+    }
+    cluster_scatter(points, cluster_assignments, widest, center.data(), nullptr, scatter.data());
+    for (int j = 0; j < dim; j++) {
+        axis[j] = std::sqrt(scatter[j]);
+    }
+
+    // |C v| of a unit vector v converges to the largest eigenvalue of the covariance C
+    double variance = 0.0;
+    for (int iteration = 0; iteration <= SPLIT_POWER_ITERATIONS; iteration++) {
+        double norm = 0.0;
+        for (int j = 0; j < dim; j++) {
+            norm += axis[j] * axis[j];
+        }
+        norm = std::sqrt(norm);
+        if (norm == 0.0) break;
+        for (int j = 0; j < dim; j++) {
+            axis[j] /= norm;
+        }
+        if (iteration == SPLIT_POWER_ITERATIONS) break;
+
+        cluster_scatter(points, cluster_assignments, widest, center.data(), axis.data(), scatter.data());
+        std::swap(axis, scatter);
+        variance = 0.0;
+        for (int j = 0; j < dim; j++) {
+            variance += axis[j] * axis[j];
+        }
+        variance = std::sqrt(variance) / std::max(counts[widest], 1L);
+    }
+
+    const double offset = SPLIT_OFFSET * std::sqrt(variance);
+    const int farthest = offset > 0.0 ? -1 : farthest_point(points, centroids, cluster_assignments);
+    if (farthest >= 0) {
+        for (int j = 0; j < dim; j++) {
+            split.column(j)[num_centroids] = points.column(j)[farthest];
+        }
+        return cluster_assignments[farthest];
+    }
+
+    for (int j = 0; j < dim; j++) {
+        split.column(j)[widest] = center[j] - offset * axis[j];
+        split.column(j)[num_centroids] = center[j] + offset * axis[j];
+    }
+    return widest;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "point_set.hpp"
+#include "seeding.hpp"
+
+// Random streams used by the generator, kept apart from the ones used by the seeding
+constexpr std::uint64_t SYNTHETIC_CENTER_STREAM = 1000;
+constexpr std::uint64_t SYNTHETIC_POINT_STREAM = 2000;
+
+/**
+ * Shape of a synthetic data set
+ *
+ * size: number of points
+ * dim: dimension of each point
+ * clusters: number of gaussian blobs
+ * spread: standard deviation of every blob around its center
+ * seed: the same seed gives the same points regardless of the number of threads
+ **/
+struct SyntheticOptions {
+    int size = 100000;
+    int dim = 2;
+    int clusters = 5;
+    double spread = 0.05;
+    std::uint64_t seed = 0;
+};
+
+/**
+ * Standard normal number for a given seed, stream and counter (Box-Muller on two counter-based uniforms)
+ *
+ * @param seed user seed
+ * @param stream independent sequence
+ * @param counter position within the stream
+ *
+ * @return normally distributed double with mean 0 and standard deviation 1
+ **/
+inline double random_normal(const std::uint64_t seed, const std::uint64_t stream, const std::uint64_t counter) {
+    double u1 = 1.0 - random_uniform(seed, stream, 2 * counter);
+    double u2 = random_uniform(seed, stream, 2 * counter + 1);
+    return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+}
+
+/**
+ * Generates a clustered data set: the centers of the blobs are uniform in [0, 1)^dim and every point
+ * picks a blob uniformly and is displaced from its center by a gaussian of the given spread. Every
+ * coordinate is drawn with its own counter, so the points are reproducible and generated in parallel.
+ * For the same reason a part of the data set can be generated on its own: part p of parts holds the
+ * points [p * size / parts, (p + 1) * size / parts), identical to those of the whole data set.
+ *
+ * @param points memory where the points will be stored
+ * @param options shape of the data set
+ * @param part index of the part to generate
+ * @param parts number of parts the data set is split into
+ **/
+template <typename T>
+inline void generate_clustered_points(BasicPointSet<T>& points, const SyntheticOptions& options, const int part = 0, const int parts = 1) {
+    const int dim = options.dim;
+    const int clusters = std::max(options.clusters, 1);
+    const long first = (long)options.size * part / parts;
+    const long last = (long)options.size * (part + 1) / parts;
+    alloc_points(points, last - first, dim);
+
+    std::vector<double> centers((std::size_t)clusters * dim);
+    for (int c = 0; c < clusters; c++) {
+        for (int j = 0; j < dim; j++) {
+            centers[(std::size_t)c * dim + j] = random_uniform(options.seed, SYNTHETIC_CENTER_STREAM + j, c);
+        }
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < points.size; i++) {
+        const long index = first + i;
+        int cluster = std::min((int)(random_uniform(options.seed, SYNTHETIC_POINT_STREAM, index) * clusters), clusters - 1);
+        for (int j = 0; j < dim; j++) {
+            double noise = random_normal(options.seed, SYNTHETIC_POINT_STREAM + 1 + j, index);
+            points.column(j)[i] = centers[(std::size_t)cluster * dim + j] + options.spread * noise;
+        }
+    }
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "convergence.hpp"
+
+/**
+ * Readable name of a phase
+ **/
+inline const char* phase_name(const int phase) {
+    switch (phase) {
+        case PHASE_ASSIGN: return "assign";
+        case PHASE_UPDATE: return "update";
+        default: return "check";
+    }
+}
+
+/**
+ * Cycle and last-level cache miss counters of every thread of the team, opened with
+ * perf_event_open. Each thread counts its own user-space events; the counters of all the threads
+ * are read and added by the master thread between phases, when the team is idle.
+ *
+ * cycles: counter descriptor of every thread
+ * llc_misses: counter descriptor of every thread
+ **/
+struct PerfCounters {
+    std::vector<int> cycles;
+    std::vector<int> llc_misses;
+};
+
+/**
+ * Opens a hardware counter for the calling thread
+ *
+ * @param config PERF_COUNT_HW_* event
+ *
+ * @return file descriptor, negative if the event is not available
+ **/
+inline int perf_open_event(const std::uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Closes the counters of every thread
+ **/
+inline void perf_close(PerfCounters& counters) {
+    for (int fd : counters.cycles) {
+        if (fd >= 0) close(fd);
+    }
+    for (int fd : counters.llc_misses) {
+        if (fd >= 0) close(fd);
+    }
+    counters.cycles.clear();
+    counters.llc_misses.clear();
+}
+
+/**
+ * Opens the counters on every thread of the team the next parallel regions will use. OpenMP keeps
+ * the same threads for teams of the same size, so the counters follow the threads of the run. If
+ * any counter cannot be opened (no PMU, perf_event_paranoid) none are used and a warning is printed.
+ *
+ * @param counters counters to open
+ *
+ * @return false if the counters are not available
+ **/
+inline bool perf_open(PerfCounters& counters) {
+#ifdef _OPENMP
+    const int num_threads = omp_get_max_threads();
+#else
+    const int num_threads = 1;
+#endif
+    counters.cycles.assign(num_threads, -1);
+    counters.llc_misses.assign(num_threads, -1);
+    int failures = 0;
+
+    #pragma omp parallel reduction(+:failures)
+    {
+#ifdef _OPENMP
+        const int thread = omp_get_thread_num();
+#else
+        const int thread = 0;
+#endif
+        counters.cycles[thread] = perf_open_event(PERF_COUNT_HW_CPU_CYCLES);
+        counters.llc_misses[thread] = perf_open_event(PERF_COUNT_HW_CACHE_MISSES);
+        if (counters.cycles[thread] < 0 || counters.llc_misses[thread] < 0) failures++;
+    }
+
+    if (failures > 0) {
+        static bool warned = false;
+        if (!warned) {
+            std::cerr << "Warning: hardware counters are not available, check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+            warned = true;
+        }
+        perf_close(counters);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Events counted so far by all the threads
+ *
+ * @param counters open counters
+ *
+ * @return totals, -1 if the counters are not open
+ **/
+inline HardwareCounts perf_read(const PerfCounters& counters) {
+    HardwareCounts totals;
+    if (counters.cycles.empty()) return totals;
+    totals.cycles = 0;
+    totals.llc_misses = 0;
+    for (std::size_t t = 0; t < counters.cycles.size(); t++) {
+        long long value = 0;
+        if (read(counters.cycles[t], &value, sizeof(value)) == sizeof(value)) totals.cycles += value;
+        if (read(counters.llc_misses[t], &value, sizeof(value)) == sizeof(value)) totals.llc_misses += value;
+    }
+    return totals;
+}
+
+/**
+ * Measures consecutive phases of an iteration: every call to next() closes the current phase
+ * with its wall time and, when counters are open, its hardware events
+ *
+ * counters: hardware counters, may be empty
+ * record: iteration the phases are stored in
+ **/
+struct PhaseTimer {
+    const PerfCounters& counters;
+    IterationRecord& record;
+    int phase = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    HardwareCounts start_counts = perf_read(counters);
+
+    PhaseTimer(const PerfCounters& counters, IterationRecord& record) : counters(counters), record(record) {}
+
+    void next() {
+        auto now = std::chrono::steady_clock::now();
+        HardwareCounts now_counts = perf_read(counters);
+        record.seconds[phase] = std::chrono::duration<double>(now - start).count();
+        if (now_counts.cycles >= 0) {
+            record.counts[phase].cycles = now_counts.cycles - start_counts.cycles;
+            record.counts[phase].llc_misses = now_counts.llc_misses - start_counts.llc_misses;
+        }
+        start = now;
+        start_counts = now_counts;
+        phase++;
+    }
+};